@@ -0,0 +1,35 @@
+/*
+ * backend.h - Interface of an allocator that mdriver loads with -b
+ *
+ * A backend is a shared object that exports one mm_backend_t named
+ * mm_backend. mdriver dlopens it and replays each trace through the
+ * table, so one run can put mm.c variants and other malloc packages
+ * side by side. The Makefile builds mm.so from mm.c (with MMFLAGS)
+ * and glibc.so, jemalloc.so and tcmalloc.so from sysbackend.c.
+ *
+ * init, malloc, free and realloc are required. A NULL calloc is done
+ * as malloc and memset; a backend without memalign can't run traces
+ * that use it. stats, if present, fills in at least heap_size and
+ * mapped_bytes, whose sum mdriver takes as the backend's footprint
+ * when it measures utilization; without it, util shows as 0.
+ */
+#ifndef __BACKEND_H_
+#define __BACKEND_H_
+
+#include "mm.h"
+
+#define MM_BACKEND_ABI 1 /* bumped whenever mm_backend_t changes */
+
+typedef struct
+{
+	int abi; /* MM_BACKEND_ABI */
+	int (*init)(void); /* called before each replay; -1 on failure */
+	void *(*malloc)(size_t size);
+	void (*free)(void *ptr);
+	void *(*realloc)(void *ptr, size_t size);
+	void *(*calloc)(size_t nmemb, size_t size);	  /* optional */
+	void *(*memalign)(size_t align, size_t size); /* optional */
+	void (*stats)(struct mm_stats *st);			  /* optional */
+} mm_backend_t;
+
+#endif /* __BACKEND_H_ */
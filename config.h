@@ -56,12 +56,53 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Default maximum heap size in bytes; mem_set_max_heap (mdriver -H)
+ * changes it at run time
  */
 #define MAX_HEAP (400*(1<<20))  /* 400 MB */
 
 /*****************************************************************************
- * Set exactly one of these USE_xxx constants to "1" to select a timing method
+ * Set exactly one of these USE_xxx constants to "1" to select how memlib
+ * backs the simulated heap
+ *****************************************************************************/
+#ifndef USE_MEM_MMAP
+#define USE_MEM_MALLOC 0   /* malloc all of MAX_HEAP up front */
+#define USE_MEM_MMAP   1   /* reserve MAX_HEAP, commit as the brk advances */
+#else
+#define USE_MEM_MALLOC (!USE_MEM_MMAP)
+#endif
+
+/*
+ * With USE_MEM_MMAP, mem_sbrk makes the reserved address space
+ * accessible MEM_COMMIT_GRAIN bytes at a time.  MEM_HUGEPAGES selects
+ * the page size behind the heap: 0 for base pages, 1 to ask for
+ * transparent huge pages, 2 for explicit MAP_HUGETLB pages (which must
+ * be reserved in /proc/sys/vm/nr_hugepages; memlib falls back to base
+ * pages if there are none).
+ */
+#ifndef MEM_HUGEPAGES
+#define MEM_HUGEPAGES 0
+#endif
+#define MEM_HUGEPAGE_SIZE (2*(1<<20))  /* 2 MB */
+#define MEM_COMMIT_GRAIN  (MEM_HUGEPAGES ? MEM_HUGEPAGE_SIZE : (1<<16))
+
+/*
+ * How mem_release gives pages back: MADV_FREE lets the kernel reclaim
+ * them lazily, which costs nothing if they are reused before memory
+ * gets tight; MADV_DONTNEED drops them at once, so RSS falls right
+ * away but the next touch faults in a zeroed page.
+ */
+#ifndef MEM_RELEASE_ADVICE
+#ifdef MADV_FREE
+#define MEM_RELEASE_ADVICE MADV_FREE
+#else
+#define MEM_RELEASE_ADVICE MADV_DONTNEED
+#endif
+#endif
+
+/*****************************************************************************
+ * Set exactly one of these USE_xxx constants to "1" to select the default
+ * timing method; mdriver -m picks another at run time
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
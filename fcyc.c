@@ -8,6 +8,7 @@
  * the time in CPU cycles for a function f.
  */
 #include <stdlib.h>
+#include <string.h>
 #include <sys/times.h>
 #include <stdio.h>
 
@@ -113,6 +114,8 @@ static void clear()
 	    fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 	    exit(1);
 	}
+	/* Untouched pages all read as the one zero page: write them */
+	memset(cache_buf, 0, cache_bytes);
     }
     cptr = (int *) cache_buf;
     cend = cptr + cache_bytes/sizeof(int);
@@ -123,6 +126,14 @@ static void clear()
     sink = x;
 }
 
+/*
+ * clear_fcyc_cache - Run the cache-clearing code once
+ */
+void clear_fcyc_cache(void)
+{
+    clear();
+}
+
 /*
  * fcyc - Use K-best scheme to estimate the running time of function f
  */
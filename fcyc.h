@@ -24,6 +24,12 @@ double fcyc(test_funct f, void* argp);
  */
 void set_fcyc_clear_cache(int clear);
 
+/*
+ * clear_fcyc_cache - Clear the cache now, as before a measurement,
+ *     for timers other than fcyc
+ */
+void clear_fcyc_cache(void);
+
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
  *     Default = 1<<19 (512KB)
@@ -2,56 +2,174 @@
  * High-level timing wrappers
  ****************************/
 #include <stdio.h>
+#include <unistd.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
 #include "config.h"
 
+#define FTIMER_RUNS 10          /* runs averaged by the interval timers */
+#define MAXSAMPLES  20          /* K-best gives up after this many... */
+#define EPSILON     0.01        /* ... unless the k fastest are this close */
+#define LLC_BYTES   (8<<20)     /* last-level cache, if sysconf can't tell */
+#define LINE_BYTES  64          /* cache block, likewise */
+
+const char *fsecs_names[FSECS_METHODS] = {"cycles", "itimer", "gettod"};
+
 static double Mhz;  /* estimated CPU clock frequency */
 
+static fsecs_method_t method = FSECS_DEFAULT;
+static int cold = -1;        /* flush the caches before each run? */
+static int flush_bytes = 0;  /* bytes read to flush them */
+static int kbest = 0;        /* K in the K-best scheme, or 0 */
+
 extern int verbose; /* -v option in mdriver.c */
 
+void set_fsecs_method(fsecs_method_t m)
+{
+    method = m;
+}
+
+void set_fsecs_cold(int cold_arg, int bytes)
+{
+    cold = cold_arg;
+    flush_bytes = bytes;
+}
+
+void set_fsecs_k(int k)
+{
+    kbest = k;
+}
+
+int fsecs_flush_bytes(void)
+{
+    return flush_bytes;
+}
+
+int fsecs_cold(void)
+{
+    return cold;
+}
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+/*
+ * cache_param - The cache parameter name from sysconf, or dflt if the
+ *     C library does not know it
+ */
+static long cache_param(int name, long dflt)
+{
+    long v = sysconf(name);
+
+    return v > 0 ? v : dflt;
+}
+#endif
+
 /*
  * init_fsecs - initialize the timing package
  */
 void init_fsecs(void)
 {
+    long llc = LLC_BYTES, line = LINE_BYTES;
+    int maxsamples = kbest > MAXSAMPLES / 2 ? 2 * kbest : MAXSAMPLES;
+
     Mhz = 0; /* keep gcc -Wall happy */
 
-#if USE_FCYC
-    if (verbose)
-	printf("Measuring performance with a cycle counter.\n");
-
-    /* set key parameters for the fcyc package */
-    set_fcyc_maxsamples(20); 
-    set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
-    set_fcyc_epsilon(0.01);
-    set_fcyc_k(3);
-    Mhz = mhz(verbose > 0);
-#elif USE_ITIMER
-    if (verbose)
-	printf("Measuring performance with the interval timer.\n");
-#elif USE_GETTOD
-    if (verbose)
-	printf("Measuring performance with gettimeofday().\n");
+    /*
+     * Reading twice the last-level cache displaces every line in it,
+     * the allocator's metadata included, despite inexact LRU
+     */
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    llc = cache_param(_SC_LEVEL3_CACHE_SIZE,
+                      cache_param(_SC_LEVEL2_CACHE_SIZE, LLC_BYTES));
+    line = cache_param(_SC_LEVEL1_DCACHE_LINESIZE, LINE_BYTES);
 #endif
+    /* the fcyc package has always timed cold; the interval timers warm */
+    if (cold < 0)
+        cold = method == FSECS_FCYC;
+    if (flush_bytes == 0)
+        flush_bytes = 2 * llc;
+    set_fcyc_cache_size(flush_bytes);
+    set_fcyc_cache_block(line);
+    set_fcyc_clear_cache(cold);
+
+    if (method == FSECS_FCYC) {
+        if (verbose)
+            printf("Measuring performance with a cycle counter");
+
+        /* set key parameters for the fcyc package */
+        set_fcyc_maxsamples(maxsamples);
+        set_fcyc_compensate(1);
+        set_fcyc_epsilon(EPSILON);
+        set_fcyc_k(kbest ? kbest : 3);
+    }
+    else if (verbose) {
+        printf("Measuring performance with %s",
+               method == FSECS_ITIMER ? "the interval timer" : "gettimeofday()");
+    }
+    if (verbose) {
+        if (cold)
+            printf(", flushing %d KB of cache before each run", flush_bytes >> 10);
+        if (kbest)
+            printf(", %d-best", kbest);
+        printf(".\n");
+    }
+    if (method == FSECS_FCYC)
+        Mhz = mhz(verbose > 0);
 }
 
 /*
- * fsecs - Return the running time of a function f (in seconds)
+ * ftimer_kbest - Time single runs of f with the interval timer or
+ *     gettimeofday until the kbest fastest are within EPSILON of each
+ *     other, and return the fastest.  Without K-best, return the
+ *     average of FTIMER_RUNS runs.
  */
-double fsecs(fsecs_test_funct f, void *argp) 
+static double ftimer_kbest(fsecs_test_funct f, void *argp)
 {
-#if USE_FCYC
-    double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
-#elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
-#elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
-#endif 
-}
+    double (*timer)(ftimer_test_funct, void *, int) =
+        method == FSECS_ITIMER ? ftimer_itimer : ftimer_gettod;
+    double values[kbest ? kbest : 1], v, sum = 0;
+    int n, pos, maxsamples = kbest > MAXSAMPLES / 2 ? 2 * kbest : MAXSAMPLES;
+
+    if (kbest == 0) {
+        if (!cold)
+            return timer(f, argp, FTIMER_RUNS);
+        for (n = 0; n < FTIMER_RUNS; n++) {
+            clear_fcyc_cache();
+            sum += timer(f, argp, 1);
+        }
+        return sum / FTIMER_RUNS;
+    }
 
+    for (n = 0; n < maxsamples; n++) {
+        if (cold)
+            clear_fcyc_cache();
+        v = timer(f, argp, 1);
 
+        /* insert v among the kbest fastest so far, kept sorted */
+        if (n < kbest)
+            pos = n;
+        else if (v < values[kbest - 1])
+            pos = kbest - 1;
+        else
+            continue;
+        for (; pos > 0 && values[pos - 1] > v; pos--)
+            values[pos] = values[pos - 1];
+        values[pos] = v;
+        if (n + 1 >= kbest && (1 + EPSILON) * values[0] >= values[kbest - 1])
+            break;
+    }
+    return values[0];
+}
+
+/*
+ * fsecs - Return the running time of a function f (in seconds)
+ */
+double fsecs(fsecs_test_funct f, void *argp)
+{
+    if (method == FSECS_FCYC) {
+        double cycles = fcyc(f, argp);
+        return cycles/(Mhz*1e6);
+    }
+    return ftimer_kbest(f, argp);
+}
@@ -1,4 +1,55 @@
+#include "config.h"
+
 typedef void (*fsecs_test_funct)(void *);
 
+/* Timing methods */
+typedef enum {
+    FSECS_FCYC,    /* cycle counter */
+    FSECS_ITIMER,  /* interval timer */
+    FSECS_GETTOD,  /* gettimeofday */
+    FSECS_METHODS
+} fsecs_method_t;
+
+/* The one config.h picks */
+#if USE_FCYC
+#define FSECS_DEFAULT FSECS_FCYC
+#elif USE_ITIMER
+#define FSECS_DEFAULT FSECS_ITIMER
+#else
+#define FSECS_DEFAULT FSECS_GETTOD
+#endif
+
+/* Names of the methods, as mdriver -m takes them */
+extern const char *fsecs_names[FSECS_METHODS];
+
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+
+/*
+ * These take effect at the next init_fsecs
+ */
+
+/* set_fsecs_method - Time with method m */
+void set_fsecs_method(fsecs_method_t m);
+
+/*
+ * set_fsecs_cold - When cold is set, flush the caches by reading a
+ *     buffer of bytes bytes before each run; 0 bytes for twice the
+ *     size of the last-level cache.  cold -1 is the default: cold with
+ *     the cycle counter, warm with the others
+ */
+void set_fsecs_cold(int cold, int bytes);
+
+/*
+ * set_fsecs_k - Measure with the K-best scheme: time single runs until
+ *     the k fastest agree, and take the fastest.  0 for the method's
+ *     own scheme (3-best with the cycle counter, else the average of
+ *     10 runs).  Default = 0
+ */
+void set_fsecs_k(int k);
+
+/* fsecs_flush_bytes - Bytes read to flush the caches, once initialized */
+int fsecs_flush_bytes(void);
+
+/* fsecs_cold - Are the caches flushed before each run?  Once initialized */
+int fsecs_cold(void);
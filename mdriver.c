@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* sched_setaffinity and sched_getcpu (-p) */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,12 +15,24 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
+#include <math.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dlfcn.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "perfctr.h"
 #include "config.h"
+#include "trace.h"
+#include "backend.h"
 
 /**********************
  * Constants and macros
@@ -31,34 +44,62 @@
 #define HDRLINES 4		   /* number of header lines in a trace file */
 #define LINENUM(i) (i + 5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Blocks a request allocates or frees */
+#define OP_BLOCKS(op) (((op)->type == ALLOC_BATCH || (op)->type == FREE_BATCH) ? \
+					   (op)->count : 1)
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p) ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
+/* 
+ * Latency histograms (-L) are log-linear: values below LAT_SUB get a
+ * bucket each, and every power of two above that is split into
+ * LAT_SUB buckets, so a bucket is never more than 1/LAT_SUB of its
+ * values wide.  Values are in timer ticks.
+ */
+#define LAT_SUB_BITS 4
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+#define LAT_TYPES 7 /* one histogram per RequestType */
+
+/* Histogram bucket of a latency v, and the smallest value in bucket b */
+#define LAT_BUCKET(v) ((v) < LAT_SUB ? (int)(v) : lat_bucket(v))
+#define LAT_BUCKET_LO(b) ((b) < LAT_SUB ? (uint64_t)(b) :     \
+		(uint64_t)(((b) & (LAT_SUB - 1)) + LAT_SUB)      \
+			<< (((b) >> LAT_SUB_BITS) - 1))
+
+/* Multithreaded replay (-T) */
+#define MT_RUNS 3		/* runs per thread count; the fastest one counts */
+#define MT_QUEUE 1024	/* blocks in flight between two threads, a power of 2 */
+#define MT_DRAIN 32		/* handoff: requests between looks at the queue */
+
+/* The latency timer: the time stamp counter where there is one */
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LAT_NOW() ((uint64_t)__rdtsc())
+#else
+#define LAT_NOW() lat_clock_ns()
+#endif
+
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload.  The ranges of a trace
+ * form a treap ordered by lo, so overlap checks and removal take
+ * O(log n) expected time; records come from a pool.
+ */
 typedef struct range_t
 {
-	char *lo;			  /* low payload address */
-	char *hi;			  /* high payload address */
-	struct range_t *next; /* next list element */
+	char *lo;			   /* low payload address */
+	char *hi;			   /* high payload address */
+	struct range_t *left;  /* ranges below lo (also the pool's free list) */
+	struct range_t *right; /* ranges above lo */
+	unsigned prio;		   /* treap priority, a max-heap */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef enum
-{
-	ALLOC,
-	FREE,
-	REALLOC
-} RequestType;
-typedef struct
-{
-	RequestType type; /* type of request */
-	int index;		  /* index for free() to use later */
-	int size;		  /* byte size of alloc/realloc request */
-} traceop_t;
+#define RANGE_CHUNK 4096   /* range records allocated at a time */
 
 /* Holds the information for one trace file*/
 typedef struct
@@ -68,6 +109,8 @@ typedef struct
 	int num_ops;		 /* number of distinct requests */
 	int weight;			 /* weight for this trace (unused) */
 	traceop_t *ops;		 /* array of requests */
+	void *map;			 /* mapping of a binary trace file, or NULL... */
+	size_t map_len;		 /* ... and its length */
 	char **blocks;		 /* array of ptrs returned by malloc/realloc... */
 	size_t *block_sizes; /* ... and a corresponding array of payload sizes */
 } trace_t;
@@ -81,8 +124,55 @@ typedef struct
 {
 	trace_t *trace;
 	range_t *ranges;
+	const mm_backend_t *backend; /* for eval_backend_speed */
 } speed_t;
 
+/* Latencies of one type of request, in timer ticks */
+typedef struct lathist_t
+{
+	uint64_t count;				  /* number of samples */
+	uint64_t max;				  /* largest sample */
+	uint64_t bucket[LAT_BUCKETS]; /* sample counts, see lat_bucket() */
+} lathist_t;
+
+/* Ways of dividing a trace among the threads of a replay (-P) */
+typedef enum
+{
+	MT_COPIES,	/* every thread replays the whole trace */
+	MT_SPLIT,	/* each thread replays the requests of a range of ids */
+	MT_HANDOFF	/* like MT_COPIES, with blocks freed by the next thread */
+} mtpattern_t;
+
+/* 
+ * A queue of blocks for one thread to free on behalf of another. Only
+ * the producer writes head and only the consumer writes tail, each on
+ * its own cache line, so neither side takes a lock.
+ */
+typedef struct
+{
+	unsigned head;		   /* next slot to fill */
+	int done;			   /* set once the producer will push no more */
+	char pad1[56];
+	unsigned tail;		   /* next slot to free */
+	char pad2[60];
+	char *slot[MT_QUEUE];
+} mtqueue_t;
+
+/* One thread of a multithreaded replay */
+typedef struct
+{
+	pthread_t tid;
+	traceop_t *ops;	 /* requests to replay... */
+	int num_ops;	 /* ... and how many */
+	char **blocks;	 /* this thread's blocks, by id */
+	mtqueue_t *out;	 /* handoff: blocks for the next thread to free */
+	mtqueue_t *in;	 /* handoff: blocks to free for the previous thread */
+	double ops_done; /* requests, including frees done for others */
+	uint64_t start;	 /* clock_gettime ns when this thread started... */
+	uint64_t end;	 /* ... and finished its requests */
+	double secs;	 /* time from the start of the run to finishing */
+} mtthread_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct
 {
@@ -93,10 +183,38 @@ typedef struct
 
 	/* defined only for the student malloc package */
 	double util; /* space utilization for this trace (always 0 for libc) */
+	struct lathist_t *lat; /* per-RequestType latencies (-L), else NULL */
+
+	/* hardware events in one speed run (-C), -1 if not counted */
+	int counted;				   /* were the counters read? */
+	double perf[PERFCTR_NEVENTS]; /* indexed by PERFCTR_* */
+
+	/* every speed measurement (-r); secs is their median, and the
+	   median is between ci_lo and ci_hi with 95% confidence */
+	int nsamples;
+	double *samples;
+	double ci_lo, ci_hi;
 
 	/* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/* What a -p worker reports back about its trace */
+typedef struct
+{
+	int valid;	 /* as in stats_t */
+	double util; /* as in stats_t */
+	int errors;	 /* errors the worker found */
+	size_t text; /* bytes of its output that follow */
+} check_t;
+
+/* An allocator run besides mm.c: libc malloc (-l) or a backend (-b) */
+typedef struct
+{
+	char *name;				/* "libc", or the backend's file name less ".so" */
+	const mm_backend_t *vt; /* its entry points */
+	stats_t *stats;			/* its results, one per trace */
+} alloc_t;
+
 /********************
  * Global variables
  *******************/
@@ -104,9 +222,43 @@ int verbose = 0;	   /* global flag for verbose output */
 static int errors = 0; /* number of errs found when running student malloc */
 char msg[MAXLINE];	   /* for whenever we need to compose an error message */
 
+/* Calibration of the latency timer against the wall clock (-L) */
+static uint64_t lat_overhead = 0; /* ticks taken by back-to-back reads */
+static double lat_ticks = 0;	  /* ticks elapsed in latency runs... */
+static double lat_ns = 0;		  /* ... and the nanoseconds they took */
+
+/* Multithreaded replays start together at this barrier (-T) */
+static pthread_barrier_t mt_barrier;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* Utilization timeline (-U): sample every this many requests, or 0 */
+static int util_every = 0;
+
+/* Speed measurements per trace (-r); the median counts */
+static int speed_runs = 1;
+
+/* How each measurement is taken (-m, -c, -k), as printjson reports it */
+static fsecs_method_t timer = FSECS_DEFAULT;
+static int cold = -1;    /* -1 until -c: the timer's own default */
+static int kbest = 0;
+
+/* libc malloc (-l), run through the same code as the -b backends */
+static int libc_init(void);
+static const mm_backend_t libc_backend = {
+	.abi = MM_BACKEND_ABI,
+	.init = libc_init,
+	.malloc = malloc,
+	.free = free,
+	.realloc = realloc,
+	.calloc = calloc,
+	.memalign = aligned_alloc,
+};
+
+/* Pool of unused range records, linked through their left fields */
+static range_t *range_pool = NULL;
+
 /* The filenames of the default tracefiles */
 static const char *default_tracefiles[] = {
 	DEFAULT_TRACEFILES, NULL};
@@ -120,23 +272,68 @@ static int add_range(range_t **ranges, char *lo, int size,
 					 int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *range_split(range_t *t, char *key, range_t **ge);
+static range_t *range_merge(range_t *l, range_t *r);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static int map_trace(trace_t *trace, FILE *tracefile, const char *path);
 static void free_trace(trace_t *trace);
+static double trace_reqs(trace_t *trace);
 
-/* Routines for evaluating the correctness and speed of libc malloc */
-static int eval_libc_valid(trace_t *trace, int tracenum);
-static void eval_libc_speed(void *ptr);
+/* Routines for evaluating libc malloc and the allocators of -b */
+static const mm_backend_t *load_backend(const char *path);
+static int eval_backend_valid(const mm_backend_t *vt, trace_t *trace,
+							  int tracenum, const char *name);
+static double eval_backend_util(const mm_backend_t *vt, trace_t *trace);
+static void eval_backend_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+						   FILE *timeline);
+static void eval_mm_check(trace_t *trace, int tracenum, const char *filename,
+						  range_t **ranges, stats_t *stats);
+static void eval_mm_parallel(char **tracefiles, int n, int jobs,
+							 stats_t *stats);
+static void eval_mm_worker(char *filename, int tracenum, int fd);
+static int read_all(int fd, void *buf, size_t len);
+static int write_all(int fd, const void *buf, size_t len);
+static double time_speed(fsecs_test_funct f, speed_t *params,
+						 stats_t *stats);
+static int pin_cpu(cpu_set_t *old);
+static FILE *open_timeline(const char *filename);
+static void util_sample(FILE *timeline, int opnum, int payload);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, lathist_t *lat);
+
+/* These functions keep and report the latency histograms */
+static inline int lat_bucket(uint64_t v);
+static uint64_t lat_clock_ns(void);
+static void lat_calibrate(void);
+static double lat_percentile(const lathist_t *h, double q);
+static void lat_merge(lathist_t *dst, const lathist_t *src);
+static void printlatency(int n, stats_t *stats);
+static void printperf(double perf[PERFCTR_NEVENTS], double ops);
+static void printmmstats(void);
+
+/* These functions replay a trace on several threads at once */
+static void eval_mm_threads(trace_t *trace, int tracenum, int max_threads,
+							mtpattern_t pattern);
+static double mt_run(trace_t *trace, int nthreads, mtpattern_t pattern,
+					 mtthread_t *threads, mtqueue_t *queues);
+static void *mt_replay(void *arg);
+static int mt_push(mtqueue_t *q, char *p);
+static int mt_drain(mtqueue_t *q);
 
 /* Various helper routines */
+static size_t parse_size(const char *arg);
 static void printresults(int n, stats_t *stats);
+static void printcompare(int n, alloc_t *allocs, int nallocs, stats_t *mm);
+static void printjson(const char *path, char **tracefiles, int n,
+					  alloc_t *allocs, int nallocs, stats_t *mm,
+					  double perfindex);
 static void usage(void);
 static void unix_error(const char *msg);
 static void malloc_error(int tracenum, int opnum, const char *msg);
@@ -153,13 +350,26 @@ int main(int argc, char **argv)
 	int num_tracefiles = 0;		/* the number of traces in that array */
 	trace_t *trace = NULL;		/* stores a single trace file in memory */
 	range_t *ranges = NULL;		/* keeps track of block extents for one trace */
-	stats_t *libc_stats = NULL; /* libc stats for each trace */
+	alloc_t *allocs = NULL;		/* libc and the -b backends... */
+	int num_allocs = 0;			/* ... and how many */
+	int num_backends = 0;		/* the -b ones among them */
+	alloc_t *al;
+	char *base;
 	stats_t *mm_stats = NULL;	/* mm (i.e. student) stats for each trace */
 	speed_t speed_params;		/* input parameters to the xx_speed routines */
 
 	int team_check = 1; /* If set, check team structure (reset by -a) */
-	int run_libc = 0;	/* If set, run libc malloc (set by -l) */
 	int autograder = 0; /* If set, emit summary info for autograder (-g) */
+	int latency = 0;	/* If set, time each request (set by -L) */
+	int counters = 0;	/* If set, count hardware events (set by -C) */
+	int threads = 0;	/* If set, replay on up to this many threads (-T) */
+	mtpattern_t pattern = MT_COPIES; /* how threads share a trace (-P) */
+	size_t heapsize;	/* simulated heap size limit (set by -H) */
+	int jobs = 1;		/* worker processes for the checks (-p) */
+	char *json = NULL;	/* If set, write the results here as JSON (-J) */
+	size_t flush;		/* bytes read to flush the caches (-c cold:<size>) */
+	cpu_set_t cpus;		/* CPUs to go back to after the timed runs (-p) */
+	int pinned = 0;		/* were the timed runs pinned to one CPU? */
 
 	/* temporaries used to compute the performance index */
 	double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -168,7 +378,7 @@ int main(int argc, char **argv)
 	/* 
      * Read and interpret the command line arguments 
      */
-	while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF)
+	while ((c = getopt(argc, argv, "f:t:hvVgalLCH:T:P:U:b:p:r:J:m:c:k:")) != EOF)
 	{
 		switch (c)
 		{
@@ -196,7 +406,117 @@ int main(int argc, char **argv)
 			team_check = 0;
 			break;
 		case 'l': /* Run libc malloc */
-			run_libc = 1;
+		case 'b': /* Run the allocator in a shared object */
+			if ((allocs = (alloc_t *)realloc(allocs, (num_allocs + 1) * sizeof(alloc_t))) == NULL)
+				unix_error("ERROR: realloc failed in main");
+			al = &allocs[num_allocs++];
+			if (c == 'l')
+			{
+				al->name = "libc";
+				al->vt = &libc_backend;
+			}
+			else
+			{
+				base = strrchr(optarg, '/');
+				al->name = strdup(base != NULL ? base + 1 : optarg);
+				if (strlen(al->name) > 3 && !strcmp(al->name + strlen(al->name) - 3, ".so"))
+					al->name[strlen(al->name) - 3] = '\0';
+				al->vt = load_backend(optarg);
+				num_backends++;
+			}
+			break;
+		case 'L': /* Report per-request latency percentiles */
+			latency = 1;
+			break;
+		case 'C': /* Report hardware event counts per request */
+			counters = 1;
+			break;
+		case 'H': /* Size limit of the simulated heap */
+			if ((heapsize = parse_size(optarg)) == 0)
+			{
+				usage();
+				exit(1);
+			}
+			mem_set_max_heap(heapsize);
+			break;
+		case 'T': /* Measure scaling on up to this many threads */
+			if ((threads = atoi(optarg)) < 1)
+			{
+				usage();
+				exit(1);
+			}
+			break;
+		case 'P': /* How the threads of -T share each trace */
+			if (!strcmp(optarg, "copies"))
+				pattern = MT_COPIES;
+			else if (!strcmp(optarg, "split"))
+				pattern = MT_SPLIT;
+			else if (!strcmp(optarg, "handoff"))
+				pattern = MT_HANDOFF;
+			else
+			{
+				usage();
+				exit(1);
+			}
+			break;
+		case 'U': /* Write a utilization timeline for each trace */
+			if ((util_every = atoi(optarg)) < 1)
+			{
+				usage();
+				exit(1);
+			}
+			break;
+		case 'p': /* Check the traces in this many worker processes */
+			if ((jobs = atoi(optarg)) < 1)
+			{
+				usage();
+				exit(1);
+			}
+			break;
+		case 'r': /* Measure the speed of each trace this many times */
+			if ((speed_runs = atoi(optarg)) < 1)
+			{
+				usage();
+				exit(1);
+			}
+			break;
+		case 'J': /* Write the results as JSON */
+			json = optarg;
+			break;
+		case 'm': /* Time with this method */
+			for (timer = 0; timer < FSECS_METHODS; timer++)
+				if (!strcmp(optarg, fsecs_names[timer]))
+					break;
+			if (timer == FSECS_METHODS)
+			{
+				usage();
+				exit(1);
+			}
+			set_fsecs_method(timer);
+			break;
+		case 'c': /* Time with warm or cold caches */
+			flush = 0;
+			if (!strcmp(optarg, "warm"))
+				cold = 0;
+			else if (!strcmp(optarg, "cold"))
+				cold = 1;
+			else if (!strncmp(optarg, "cold:", 5) &&
+					 (flush = parse_size(optarg + 5)) > 0 && flush <= INT_MAX)
+				cold = 1;
+			else
+			{
+				usage();
+				exit(1);
+			}
+			set_fsecs_cold(cold, (int)flush);
+			break;
+		case 'k': /* K-best measurements */
+			if ((kbest = atoi(optarg)) < 1)
+			{
+				usage();
+				exit(1);
+			}
+			set_fsecs_k(kbest);
 			break;
 		case 'v': /* Print per-trace performance breakdown */
 			verbose = 1;
@@ -257,43 +577,84 @@ int main(int argc, char **argv)
 
 	/* Initialize the timing package */
 	init_fsecs();
+	if (counters && perfctr_init() == 0)
+	{
+		printf("No hardware counters could be opened "
+			   "(check /proc/sys/kernel/perf_event_paranoid); ignoring -C.\n");
+		counters = 0;
+	}
+
+	/* Initialize the simulated memory system in memlib.c */
+	mem_init();
+
+	/* Allocate the mm stats array, with one stats_t struct per tracefile */
+	mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (mm_stats == NULL)
+		unix_error("mm_stats calloc in main failed");
+
+	/*
+     * With -p, check the mm package on every trace up front, in worker
+     * processes, and keep all the timed runs that follow on one CPU
+     */
+	if (jobs > 1)
+	{
+		if (verbose > 1)
+			printf("\nChecking mm malloc in %d workers\n", jobs);
+		eval_mm_parallel(tracefiles, num_tracefiles, jobs, mm_stats);
+		pinned = pin_cpu(&cpus);
+	}
 
 	/*
-     * Optionally run and evaluate the libc malloc package 
+     * Optionally run and evaluate libc malloc and the -b backends
      */
-	if (run_libc)
+	for (al = allocs; al < allocs + num_allocs; al++)
 	{
 		if (verbose > 1)
-			printf("\nTesting libc malloc\n");
+			printf("\nTesting %s\n", al->name);
 
-		/* Allocate libc stats array, with one stats_t struct per tracefile */
-		libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-		if (libc_stats == NULL)
-			unix_error("libc_stats calloc in main failed");
+		/* Allocate its stats array, with one stats_t struct per tracefile */
+		al->stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+		if (al->stats == NULL)
+			unix_error("allocator stats calloc in main failed");
 
-		/* Evaluate the libc malloc package using the K-best scheme */
+		/* Evaluate it using the K-best scheme */
 		for (i = 0; i < num_tracefiles; i++)
 		{
 			trace = read_trace(tracedir, tracefiles[i]);
-			libc_stats[i].ops = trace->num_ops;
+			al->stats[i].ops = trace_reqs(trace);
 			if (verbose > 1)
-				printf("Checking libc malloc for correctness, ");
-			libc_stats[i].valid = eval_libc_valid(trace, i);
-			if (libc_stats[i].valid)
+				printf("Checking %s for correctness, ", al->name);
+			al->stats[i].valid = eval_backend_valid(al->vt, trace, i, al->name);
+			if (al->stats[i].valid)
 			{
+				if (al->vt->stats != NULL)
+				{
+					if (verbose > 1)
+						printf("efficiency, ");
+					al->stats[i].util = eval_backend_util(al->vt, trace);
+				}
 				speed_params.trace = trace;
+				speed_params.backend = al->vt;
 				if (verbose > 1)
 					printf("and performance.\n");
-				libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+				al->stats[i].secs = time_speed(eval_backend_speed, &speed_params,
+											   &al->stats[i]);
+				if (counters)
+				{
+					perfctr_start();
+					eval_backend_speed(&speed_params);
+					perfctr_stop(al->stats[i].perf);
+					al->stats[i].counted = 1;
+				}
 			}
 			free_trace(trace);
 		}
 
-		/* Display the libc results in a compact table */
+		/* Display its results in a compact table */
 		if (verbose)
 		{
-			printf("\nResults for libc malloc:\n");
-			printresults(num_tracefiles, libc_stats);
+			printf("\nResults for %s:\n", al->name);
+			printresults(num_tracefiles, al->stats);
 		}
 	}
 
@@ -303,32 +664,38 @@ int main(int argc, char **argv)
 	if (verbose > 1)
 		printf("\nTesting mm malloc\n");
 
-	/* Allocate the mm stats array, with one stats_t struct per tracefile */
-	mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-	if (mm_stats == NULL)
-		unix_error("mm_stats calloc in main failed");
-
-	/* Initialize the simulated memory system in memlib.c */
-	mem_init();
-
 	/* Evaluate student's mm malloc package using the K-best scheme */
 	for (i = 0; i < num_tracefiles; i++)
 	{
 		trace = read_trace(tracedir, tracefiles[i]);
-		mm_stats[i].ops = trace->num_ops;
-		if (verbose > 1)
-			printf("Checking mm_malloc for correctness, ");
-		mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+		mm_stats[i].ops = trace_reqs(trace);
+		if (jobs == 1)
+			eval_mm_check(trace, i, tracefiles[i], &ranges, &mm_stats[i]);
 		if (mm_stats[i].valid)
 		{
-			if (verbose > 1)
-				printf("efficiency, ");
-			mm_stats[i].util = eval_mm_util(trace, i, &ranges);
 			speed_params.trace = trace;
 			speed_params.ranges = ranges;
 			if (verbose > 1)
-				printf("and performance.\n");
-			mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+				printf("Timing mm_malloc.\n");
+			mm_stats[i].secs = time_speed(eval_mm_speed, &speed_params,
+										  &mm_stats[i]);
+			if (counters)
+			{
+				/* one more speed run, with the counters on */
+				perfctr_start();
+				eval_mm_speed(&speed_params);
+				perfctr_stop(mm_stats[i].perf);
+				mm_stats[i].counted = 1;
+			}
+			if (latency)
+			{
+				if (verbose > 1)
+					printf("Timing each mm request.\n");
+				mm_stats[i].lat = (lathist_t *)calloc(LAT_TYPES, sizeof(lathist_t));
+				if (mm_stats[i].lat == NULL)
+					unix_error("latency calloc in main failed");
+				eval_mm_latency(trace, mm_stats[i].lat);
+			}
 		}
 		free_trace(trace);
 	}
@@ -340,6 +707,35 @@ int main(int argc, char **argv)
 		printresults(num_tracefiles, mm_stats);
 		printf("\n");
 	}
+	if (latency)
+	{
+		printlatency(num_tracefiles, mm_stats);
+		printf("\n");
+	}
+	if (num_backends > 0)
+	{
+		printcompare(num_tracefiles, allocs, num_allocs, mm_stats);
+		printf("\n");
+	}
+	if (pinned && sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+		unix_error("sched_setaffinity failed in main");
+
+	/* 
+     * Optionally measure how the mm package scales with threads,
+     * on the traces it handled correctly
+     */
+	if (threads)
+	{
+		for (i = 0; i < num_tracefiles; i++)
+		{
+			if (!mm_stats[i].valid)
+				continue;
+			trace = read_trace(tracedir, tracefiles[i]);
+			eval_mm_threads(trace, i, threads, pattern);
+			free_trace(trace);
+		}
+		printf("\n");
+	}
 
 	/* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -393,6 +789,9 @@ int main(int argc, char **argv)
 		printf("correct:%d\n", numcorrect);
 		printf("perfidx:%.0f\n", perfindex);
 	}
+	if (json != NULL)
+		printjson(json, tracefiles, num_tracefiles, allocs, num_allocs,
+				  mm_stats, perfindex);
 
 	exit(0);
 }
@@ -413,7 +812,7 @@ static int add_range(range_t **ranges, char *lo, int size,
 					 int tracenum, int opnum)
 {
 	char *hi = lo + size - 1;
-	range_t *p;
+	range_t *p, *below, *above, **link;
 	char msg[MAXLINE];
 
 	assert(size > 0);
@@ -427,9 +826,11 @@ static int add_range(range_t **ranges, char *lo, int size,
 		return 0;
 	}
 
-	/* The payload must lie within the extent of the heap */
-	if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-		(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))
+	/* The payload must lie within the extent of the heap, or inside
+	   one of the mappings memlib handed out for huge blocks */
+	if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+		 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+		!mem_mapped_range(lo, hi))
 	{
 		snprintf(msg, MAXLINE, "Payload (%p:%p) lies outside heap (%p:%p)",
 				lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -437,66 +838,137 @@ static int add_range(range_t **ranges, char *lo, int size,
 		return 0;
 	}
 
-	/* The payload must not overlap any other payloads */
-	for (p = *ranges; p != NULL; p = p->next)
+	/* 
+	 * The payload must not overlap any other payloads.  The ranges do
+	 * not overlap each other, so only the nearest one at or below lo
+	 * and the nearest one above it can.
+	 */
+	for (below = above = NULL, p = *ranges; p != NULL;)
 	{
-		if ((lo >= p->lo && lo <= p->hi) ||
-			(hi >= p->lo && hi <= p->hi))
+		if (p->lo <= lo)
+		{
+			below = p;
+			p = p->right;
+		}
+		else
 		{
-			snprintf(msg, MAXLINE, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-					lo, hi, p->lo, p->hi);
-			malloc_error(tracenum, opnum, msg);
-			return 0;
+			above = p;
+			p = p->left;
 		}
 	}
+	if ((p = (below != NULL && below->hi >= lo) ? below : NULL) != NULL ||
+		(p = (above != NULL && above->lo <= hi) ? above : NULL) != NULL)
+	{
+		snprintf(msg, MAXLINE, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+				lo, hi, p->lo, p->hi);
+		malloc_error(tracenum, opnum, msg);
+		return 0;
+	}
 
 	/* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by taking a range struct from the pool and adding it to the
+     * range treap.
      */
-	if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-		unix_error("malloc error in add_range");
-	p->next = *ranges;
+	if (range_pool == NULL)
+	{
+		range_t *chunk;
+		int i;
+
+		if ((chunk = (range_t *)malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+			unix_error("malloc error in add_range");
+		for (i = 0; i < RANGE_CHUNK; i++)
+		{
+			chunk[i].left = range_pool;
+			range_pool = &chunk[i];
+		}
+	}
+	p = range_pool;
+	range_pool = p->left;
 	p->lo = lo;
 	p->hi = hi;
-	*ranges = p;
+	p->left = p->right = NULL;
+	p->prio = (unsigned)rand();
+
+	/* while the nodes on the way down outrank p, descend; p goes here */
+	for (link = ranges; *link != NULL && (*link)->prio > p->prio;)
+		link = ((*link)->lo < lo) ? &(*link)->right : &(*link)->left;
+	p->left = range_split(*link, lo, &p->right);
+	*link = p;
 	return 1;
 }
 
+/*
+ * range_split - Split treap t into the ranges below key, which are
+ *     returned, and those at or above key, stored in *ge
+ */
+static range_t *range_split(range_t *t, char *key, range_t **ge)
+{
+	if (t == NULL)
+	{
+		*ge = NULL;
+		return NULL;
+	}
+	if (t->lo < key)
+	{
+		t->right = range_split(t->right, key, ge);
+		return t;
+	}
+	*ge = t;
+	return range_split(t->left, key, &t->left);
+}
+
+/*
+ * range_merge - Join treaps l and r, where every range in l lies
+ *     below every range in r
+ */
+static range_t *range_merge(range_t *l, range_t *r)
+{
+	if (l == NULL)
+		return r;
+	if (r == NULL)
+		return l;
+	if (l->prio > r->prio)
+	{
+		l->right = range_merge(l->right, r);
+		return l;
+	}
+	r->left = range_merge(l, r->left);
+	return r;
+}
+
 /* 
  * remove_range - Free the range record of block whose payload starts at lo 
  */
 static void remove_range(range_t **ranges, char *lo)
 {
+	range_t **link = ranges;
 	range_t *p;
-	range_t **prevpp = ranges;
 
-	for (p = *ranges; p != NULL; p = p->next)
-	{
-		if (p->lo == lo)
-		{
-			*prevpp = p->next;
-			// int size = p->hi - p->lo + 1;
-			free(p);
-			break;
-		}
-		prevpp = &(p->next);
-	}
+	while ((p = *link) != NULL && p->lo != lo)
+		link = (lo < p->lo) ? &p->left : &p->right;
+	if (p == NULL)
+		return;
+
+	*link = range_merge(p->left, p->right);
+	p->left = range_pool;
+	range_pool = p;
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - return all of the range records for a trace to the
+ *     pool
  */
 static void clear_ranges(range_t **ranges)
 {
-	range_t *p;
-	range_t *pnext;
-
-	for (p = *ranges; p != NULL; p = pnext)
-	{
-		pnext = p->next;
-		free(p);
-	}
+	range_t *p = *ranges;
+
+	if (p == NULL)
+		return;
+	clear_ranges(&p->left);
+	clear_ranges(&p->right);
+	p->left = range_pool;
+	range_pool = p;
 	*ranges = NULL;
 }
 
@@ -513,7 +985,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	trace_t *trace;
 	char type[MAXLINE];
 	char path[MAXPATH];
-	int index, size;
+	int index, size, align, count;
 	int max_index = 0;
 	int op_index;
 
@@ -531,27 +1003,33 @@ static trace_t *read_trace(char *tracedir, char *filename)
 		snprintf(msg, MAXLINE, "Could not open %500s in read_trace", path);
 		unix_error(msg);
 	}
-	if (1 != fscanf(tracefile, "%d", &(trace->sugg_heapsize)))
-	{
-		unix_error("fscanf of heapsize\n");
-	}
-	if (1 != fscanf(tracefile, "%d", &(trace->num_ids)))
-	{
-		unix_error("fscanf of num_ids");
-	}
-	if (1 != fscanf(tracefile, "%d", &(trace->num_ops)))
-	{
-		unix_error("fscanf of num_ops");
-	}
-	if (1 != fscanf(tracefile, "%d", &(trace->weight)))
+
+	/* Binary traces are used in place, text traces are parsed */
+	trace->map = NULL;
+	if (!map_trace(trace, tracefile, path))
 	{
-		unix_error("fscan of weight");
-	}
+		if (1 != fscanf(tracefile, "%d", &(trace->sugg_heapsize)))
+		{
+			unix_error("fscanf of heapsize\n");
+		}
+		if (1 != fscanf(tracefile, "%d", &(trace->num_ids)))
+		{
+			unix_error("fscanf of num_ids");
+		}
+		if (1 != fscanf(tracefile, "%d", &(trace->num_ops)))
+		{
+			unix_error("fscanf of num_ops");
+		}
+		if (1 != fscanf(tracefile, "%d", &(trace->weight)))
+		{
+			unix_error("fscan of weight");
+		}
 
-	/* We'll store each request line in the trace in this array */
-	if ((trace->ops =
-			 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-		unix_error("malloc 2 failed in read_trace");
+		/* We'll store each request line in the trace in this array */
+		if ((trace->ops =
+				 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+			unix_error("malloc 2 failed in read_trace");
+	}
 
 	/* We'll keep an array of pointers to the allocated blocks here... */
 	if ((trace->blocks =
@@ -563,6 +1041,13 @@ static trace_t *read_trace(char *tracedir, char *filename)
 			 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 		unix_error("malloc 4 failed in read_trace");
 
+	/* the ops of a binary trace are already in place */
+	if (trace->map != NULL)
+	{
+		fclose(tracefile);
+		return trace;
+	}
+
 	/* read every request line in the trace file */
 	index = 0;
 	op_index = 0;
@@ -578,6 +1063,35 @@ static trace_t *read_trace(char *tracedir, char *filename)
 			trace->ops[op_index].type = ALLOC;
 			trace->ops[op_index].index = index;
 			trace->ops[op_index].size = size;
+			trace->ops[op_index].align = 0;
+			max_index = (index > max_index) ? index : max_index;
+			break;
+		case 'c':
+			if (2 != fscanf(tracefile, "%u %u", &index, &size))
+			{
+				unix_error("fscanf of calloc");
+			}
+			trace->ops[op_index].type = CALLOC;
+			trace->ops[op_index].index = index;
+			trace->ops[op_index].size = size;
+			trace->ops[op_index].align = 0;
+			max_index = (index > max_index) ? index : max_index;
+			break;
+		case 'm':
+			if (3 != fscanf(tracefile, "%u %u %u", &index, &align, &size))
+			{
+				unix_error("fscanf of memalign");
+			}
+			if (align == 0 || (align & (align - 1)) != 0)
+			{
+				printf("Alignment %d is not a power of two in tracefile %s\n",
+					   align, path);
+				exit(1);
+			}
+			trace->ops[op_index].type = MEMALIGN;
+			trace->ops[op_index].index = index;
+			trace->ops[op_index].size = size;
+			trace->ops[op_index].align = align;
 			max_index = (index > max_index) ? index : max_index;
 			break;
 		case 'r':
@@ -588,8 +1102,31 @@ static trace_t *read_trace(char *tracedir, char *filename)
 			trace->ops[op_index].type = REALLOC;
 			trace->ops[op_index].index = index;
 			trace->ops[op_index].size = size;
+			trace->ops[op_index].align = 0;
+			max_index = (index > max_index) ? index : max_index;
+			break;
+		case 'A':
+			if (3 != fscanf(tracefile, "%u %u %u", &index, &count, &size) || count == 0)
+			{
+				unix_error("fscanf of batch allocation");
+			}
+			trace->ops[op_index].type = ALLOC_BATCH;
+			trace->ops[op_index].index = index;
+			trace->ops[op_index].size = size;
+			trace->ops[op_index].count = count;
+			index += count - 1;
 			max_index = (index > max_index) ? index : max_index;
 			break;
+		case 'F':
+			if (2 != fscanf(tracefile, "%u %u", &index, &count) || count == 0)
+			{
+				unix_error("fscanf of batch free");
+			}
+			trace->ops[op_index].type = FREE_BATCH;
+			trace->ops[op_index].index = index;
+			trace->ops[op_index].size = 0;
+			trace->ops[op_index].count = count;
+			break;
 		case 'f':
 			if (1 != fscanf(tracefile, "%ud", &index))
 			{
@@ -597,6 +1134,8 @@ static trace_t *read_trace(char *tracedir, char *filename)
 			}
 			trace->ops[op_index].type = FREE;
 			trace->ops[op_index].index = index;
+			trace->ops[op_index].size = 0;
+			trace->ops[op_index].align = 0;
 			break;
 		default:
 			printf("Bogus type character (%c) in tracefile %s\n",
@@ -612,18 +1151,113 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	return trace;
 }
 
+/*
+ * map_trace - If tracefile is a binary trace, map it read-only and
+ *     point the trace's header fields and op array into the mapping.
+ *     Returns 0, with the file position unchanged, for a text trace.
+ */
+static int map_trace(trace_t *trace, FILE *tracefile, const char *path)
+{
+	tracehdr_t hdr;
+	struct stat st;
+	traceop_t *op;
+	size_t len;
+	int i;
+
+	if (fread(&hdr, sizeof(hdr), 1, tracefile) != 1 ||
+		memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0)
+	{
+		rewind(tracefile);
+		return 0;
+	}
+	if (hdr.version != TRACE_VERSION)
+	{
+		snprintf(msg, MAXLINE, "%.500s: unknown trace version %x "
+				 "(written on another byte order?)", path, hdr.version);
+		app_error(msg);
+	}
+	len = sizeof(hdr) + (size_t)hdr.num_ops * sizeof(traceop_t);
+	if (fstat(fileno(tracefile), &st) < 0)
+		unix_error("fstat failed in map_trace");
+	if (hdr.num_ids <= 0 || hdr.num_ops < 0 || (size_t)st.st_size != len)
+	{
+		snprintf(msg, MAXLINE, "%.500s: truncated or corrupt trace", path);
+		app_error(msg);
+	}
+
+	trace->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(tracefile), 0);
+	if (trace->map == MAP_FAILED)
+		unix_error("mmap failed in map_trace");
+	madvise(trace->map, len, MADV_SEQUENTIAL);
+	trace->map_len = len;
+	trace->sugg_heapsize = hdr.sugg_heapsize;
+	trace->num_ids = hdr.num_ids;
+	trace->num_ops = hdr.num_ops;
+	trace->weight = hdr.weight;
+	trace->ops = (traceop_t *)((char *)trace->map + sizeof(hdr));
+
+	/*
+	 * The driver indexes its block arrays with these ids unchecked, so
+	 * hold each request to what the text reader would have accepted
+	 */
+	for (i = 0; i < hdr.num_ops; i++)
+	{
+		op = &trace->ops[i];
+		if (op->type < ALLOC || op->type > FREE_BATCH || op->index < 0 ||
+			op->size < 0 ||
+			((op->type == ALLOC_BATCH || op->type == FREE_BATCH) &&
+			 op->count <= 0))
+		{
+			printf("Bogus request %d (type %d) in tracefile %s\n",
+				   i, op->type, path);
+			exit(1);
+		}
+		if ((int64_t)op->index + OP_BLOCKS(op) > hdr.num_ids)
+		{
+			printf("Id %d of request %d is not below num_ids %d in tracefile %s\n",
+				   op->index + OP_BLOCKS(op) - 1, i, hdr.num_ids, path);
+			exit(1);
+		}
+		if (op->type == MEMALIGN && (op->align <= 0 || (op->align & (op->align - 1)) != 0))
+		{
+			printf("Alignment %d is not a power of two in tracefile %s\n",
+				   op->align, path);
+			exit(1);
+		}
+	}
+	return 1;
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated in read_trace(). The
+ *              ops of a binary trace are unmapped instead.
  */
 void free_trace(trace_t *trace)
 {
-	free(trace->ops); /* free the three arrays... */
+	if (trace->map != NULL) /* free the three arrays... */
+		munmap(trace->map, trace->map_len);
+	else
+		free(trace->ops);
 	free(trace->blocks);
 	free(trace->block_sizes);
 	free(trace); /* and the trace record itself... */
 }
 
+/*
+ * trace_reqs - Count the allocator requests of a trace, where a batch
+ *     of n blocks counts as n
+ */
+static double trace_reqs(trace_t *trace)
+{
+	double n = 0;
+	int i;
+
+	for (i = 0; i < trace->num_ops; i++)
+		n += OP_BLOCKS(&trace->ops[i]);
+	return n;
+}
+
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
@@ -634,10 +1268,11 @@ void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 {
-	int i, j;
+	int i, j, k;
 	int index;
 	int size;
 	int oldsize;
+	int count;
 	char *newp;
 	char *oldp;
 	char *p;
@@ -662,10 +1297,18 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		switch (trace->ops[i].type)
 		{
 
-		case ALLOC: /* mm_malloc */
+		case ALLOC:	   /* mm_malloc */
+		case CALLOC:   /* mm_calloc */
+		case MEMALIGN: /* mm_memalign */
 
 			/* Call the student's malloc */
-			if ((p = (char *)mm_malloc(size)) == NULL)
+			if (trace->ops[i].type == CALLOC)
+				p = (char *)mm_calloc(1, size);
+			else if (trace->ops[i].type == MEMALIGN)
+				p = (char *)mm_memalign(trace->ops[i].align, size);
+			else
+				p = (char *)mm_malloc(size);
+			if (p == NULL)
 			{
 				malloc_error(tracenum, i, "mm_malloc failed.");
 				return 0;
@@ -679,13 +1322,36 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 			if (add_range(ranges, p, size, tracenum, i) == 0)
 				return 0;
 
-			/* ADDED: cgw
-	     * fill range with low byte of index.  This will be used later
-	     * if we realloc the block and wish to make sure that the old
-	     * data was copied to the new block
-	     */
-			memset(p, index & 0xFF, size);
-
+			/* mm_memalign must honor the requested alignment... */
+			if (trace->ops[i].type == MEMALIGN &&
+				(uintptr_t)p % trace->ops[i].align != 0)
+			{
+				snprintf(msg, MAXLINE, "mm_memalign payload (%p) not aligned to %d bytes",
+						 p, trace->ops[i].align);
+				malloc_error(tracenum, i, msg);
+				return 0;
+			}
+
+			/* ... and mm_calloc must hand out zeroed memory */
+			if (trace->ops[i].type == CALLOC)
+			{
+				for (j = 0; j < size; j++)
+				{
+					if (p[j] != 0)
+					{
+						malloc_error(tracenum, i, "mm_calloc did not zero the block");
+						return 0;
+					}
+				}
+			}
+
+			/* ADDED: cgw
+	     * fill range with low byte of index.  This will be used later
+	     * if we realloc the block and wish to make sure that the old
+	     * data was copied to the new block
+	     */
+			memset(p, index & 0xFF, size);
+
 			/* Remember region */
 			trace->blocks[index] = p;
 			trace->block_sizes[index] = size;
@@ -718,7 +1384,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 				oldsize = size;
 			for (j = 0; j < oldsize; j++)
 			{
-				if (newp[j] != (index & 0xFF))
+				if ((unsigned char)newp[j] != (index & 0xFF))
 				{
 					malloc_error(tracenum, i, "mm_realloc did not preserve the "
 											  "data from old block");
@@ -740,6 +1406,34 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 			mm_free(p);
 			break;
 
+		case ALLOC_BATCH: /* mm_malloc_batch */
+
+			/* The blocks of a batch go straight into the block array */
+			count = trace->ops[i].count;
+			if (mm_malloc_batch(size, count, (void **)&trace->blocks[index]) != (size_t)count)
+			{
+				malloc_error(tracenum, i, "mm_malloc_batch failed.");
+				return 0;
+			}
+			for (k = index; k < index + count; k++)
+			{
+				p = trace->blocks[k];
+				if (add_range(ranges, p, size, tracenum, i) == 0)
+					return 0;
+				memset(p, k & 0xFF, size);
+				trace->block_sizes[k] = size;
+			}
+			break;
+
+		case FREE_BATCH: /* mm_free_batch */
+
+			/* mm_free_batch reorders the array, but the ids are dead */
+			count = trace->ops[i].count;
+			for (k = index; k < index + count; k++)
+				remove_range(ranges, trace->blocks[k]);
+			mm_free_batch((void **)&trace->blocks[index], count);
+			break;
+
 		default:
 			app_error("Nonexistent request type in eval_mm_valid");
 		}
@@ -758,13 +1452,16 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   package on the trace. Note that our implementation of mem_sbrk() 
  *   doesn't allow the students to decrement the brk pointer, so brk
  *   is always the high water mark of the heap. 
- *   
+ *
+ *   If timeline is not NULL, a util_sample row goes to it before the
+ *   first request and after every util_every requests and the last.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+						   FILE *timeline)
 {
-	int i;
+	int i, k;
 	int index;
-	int size, newsize, oldsize;
+	int size, newsize, oldsize, count;
 	int max_total_size = 0;
 	int total_size = 0;
 	char *p;
@@ -774,17 +1471,27 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	mem_reset_brk();
 	if (mm_init() < 0)
 		app_error("mm_init failed in eval_mm_util");
+	if (timeline != NULL)
+		util_sample(timeline, 0, 0);
 
 	for (i = 0; i < trace->num_ops; i++)
 	{
 		switch (trace->ops[i].type)
 		{
 
-		case ALLOC: /* mm_alloc */
+		case ALLOC:	   /* mm_alloc */
+		case CALLOC:   /* mm_calloc */
+		case MEMALIGN: /* mm_memalign */
 			index = trace->ops[i].index;
 			size = trace->ops[i].size;
 
-			if ((p = (char *)mm_malloc(size)) == NULL)
+			if (trace->ops[i].type == CALLOC)
+				p = (char *)mm_calloc(1, size);
+			else if (trace->ops[i].type == MEMALIGN)
+				p = (char *)mm_memalign(trace->ops[i].align, size);
+			else
+				p = (char *)mm_malloc(size);
+			if (p == NULL)
 				app_error("mm_malloc failed in eval_mm_util");
 
 			/* Remember region and size */
@@ -833,12 +1540,333 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
 			break;
 
+		case ALLOC_BATCH: /* mm_malloc_batch */
+			index = trace->ops[i].index;
+			size = trace->ops[i].size;
+			count = trace->ops[i].count;
+
+			if (mm_malloc_batch(size, count, (void **)&trace->blocks[index]) != (size_t)count)
+				app_error("mm_malloc_batch failed in eval_mm_util");
+			for (k = index; k < index + count; k++)
+				trace->block_sizes[k] = size;
+
+			total_size += size * count;
+			max_total_size = (total_size > max_total_size) ? total_size : max_total_size;
+			break;
+
+		case FREE_BATCH: /* mm_free_batch */
+			index = trace->ops[i].index;
+			count = trace->ops[i].count;
+			for (k = index; k < index + count; k++)
+				total_size -= trace->block_sizes[k];
+
+			mm_free_batch((void **)&trace->blocks[index], count);
+			break;
+
 		default:
 			app_error("Nonexistent request type in eval_mm_util");
 		}
+		if (timeline != NULL &&
+			((i + 1) % util_every == 0 || i + 1 == trace->num_ops))
+			util_sample(timeline, i + 1, total_size);
+	}
+
+	/* the heap may have been trimmed; charge for its high-water mark */
+	return ((double)max_total_size / (double)mem_heapsize_peak());
+}
+
+/*
+ * eval_mm_check - Run the validity and utilization phases of the mm
+ *   package on trace tracenum, read from filename, and fill in the
+ *   valid and util fields of *stats
+ */
+static void eval_mm_check(trace_t *trace, int tracenum, const char *filename,
+						  range_t **ranges, stats_t *stats)
+{
+	FILE *timeline;
+
+	if (verbose > 1)
+		printf("Checking mm_malloc for correctness and efficiency.\n");
+	stats->valid = eval_mm_valid(trace, tracenum, ranges);
+	if (!stats->valid)
+		return;
+	timeline = util_every ? open_timeline(filename) : NULL;
+	stats->util = eval_mm_util(trace, tracenum, ranges, timeline);
+	if (timeline != NULL && fclose(timeline) != 0)
+		unix_error("fclose of a timeline failed in eval_mm_check");
+	if (verbose > 1)
+		printmmstats();
+}
+
+/*
+ * eval_mm_parallel - Run eval_mm_check on every trace, each in a
+ *   worker process of its own with up to jobs of them at a time, and
+ *   collect the valid and util fields of stats.  A worker sends its
+ *   check_t and then its output back through a pipe; they are
+ *   collected in trace order, so that the output reads as it would
+ *   without -p.  A worker that dies counts as an error on its trace.
+ */
+static void eval_mm_parallel(char **tracefiles, int n, int jobs,
+							 stats_t *stats)
+{
+	pid_t pid, *pids;
+	int *fds, fd[2];
+	int i, next = 0, done = 0, status, ok;
+	char *text;
+	check_t check;
+
+	pids = (pid_t *)calloc(n, sizeof(pid_t));
+	fds = (int *)calloc(n, sizeof(int));
+	if (pids == NULL || fds == NULL)
+		unix_error("calloc failed in eval_mm_parallel");
+
+	fflush(stdout);
+	while (done < n)
+	{
+		if (next < n && next - done < jobs)
+		{
+			if (pipe(fd) < 0)
+				unix_error("pipe failed in eval_mm_parallel");
+			if ((pid = fork()) < 0)
+				unix_error("fork failed in eval_mm_parallel");
+			if (pid == 0)
+			{
+				close(fd[0]);
+				eval_mm_worker(tracefiles[next], next, fd[1]);
+			}
+			close(fd[1]);
+			pids[next] = pid;
+			fds[next++] = fd[0];
+			continue;
+		}
+
+		/* the oldest worker; read before reaping, or a long output blocks it */
+		i = done++;
+		ok = read_all(fds[i], &check, sizeof(check));
+		if (ok && check.text > 0)
+		{
+			if ((text = (char *)malloc(check.text)) == NULL)
+				unix_error("malloc failed in eval_mm_parallel");
+			if ((ok = read_all(fds[i], text, check.text)))
+				fwrite(text, 1, check.text, stdout);
+			free(text);
+		}
+		close(fds[i]);
+		if (waitpid(pids[i], &status, 0) < 0)
+			unix_error("waitpid failed in eval_mm_parallel");
+		if (ok && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		{
+			stats[i].valid = check.valid;
+			stats[i].util = check.util;
+			errors += check.errors;
+		}
+		else
+		{
+			errors++;
+			stats[i].valid = 0;
+			if (WIFSIGNALED(status))
+				printf("ERROR [trace %d]: worker killed by signal %d\n",
+					   i, WTERMSIG(status));
+			else
+				printf("ERROR [trace %d]: worker failed\n", i);
+		}
+	}
+	free(pids);
+	free(fds);
+}
+
+/*
+ * A -p worker's output and the pipe it goes back through: worker_send
+ *   closes the one and writes check, then the output, to the other.
+ *   A worker that gives up with exit(1) still sends what it printed.
+ */
+static FILE *worker_out;
+static char *worker_text;
+static size_t worker_len;
+static int worker_fd;
+
+static void worker_send(check_t *check)
+{
+	fclose(worker_out);
+	check->text = worker_len;
+	if (!write_all(worker_fd, check, sizeof(*check)) ||
+		!write_all(worker_fd, worker_text, worker_len))
+		_exit(1); /* the parent reports it */
+}
+
+static void worker_exit(void)
+{
+	check_t check = {0};
+
+	worker_send(&check);
+}
+
+/*
+ * eval_mm_worker - Body of a -p worker process: check the trace in
+ *   filename with stdout going to memory, and send a check_t for it
+ *   and the output to fd
+ */
+static void eval_mm_worker(char *filename, int tracenum, int fd)
+{
+	range_t *ranges = NULL;
+	trace_t *trace;
+	stats_t stats = {0};
+	check_t check;
+
+	if ((worker_out = open_memstream(&worker_text, &worker_len)) == NULL)
+		unix_error("open_memstream failed in eval_mm_worker");
+	stdout = worker_out;
+	worker_fd = fd;
+	atexit(worker_exit);
+
+	trace = read_trace(tracedir, filename);
+	eval_mm_check(trace, tracenum, filename, &ranges, &stats);
+	check.valid = stats.valid;
+	check.util = stats.util;
+	check.errors = errors;
+	worker_send(&check);
+	_exit(0);
+}
+
+/*
+ * read_all - Read exactly len bytes from fd into buf; 0 if the other
+ *   end went away first
+ */
+static int read_all(int fd, void *buf, size_t len)
+{
+	ssize_t got;
+
+	for (; len > 0; buf = (char *)buf + got, len -= got)
+		if ((got = read(fd, buf, len)) <= 0)
+		{
+			if (got < 0 && errno == EINTR)
+				got = 0;
+			else
+				return 0;
+		}
+	return 1;
+}
+
+/* write_all - Write all len bytes of buf to fd; 0 on an error */
+static int write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t put;
+
+	for (; len > 0; buf = (const char *)buf + put, len -= put)
+		if ((put = write(fd, buf, len)) < 0)
+		{
+			if (errno == EINTR)
+				put = 0;
+			else
+				return 0;
+		}
+	return 1;
+}
+
+/* cmp_double - qsort order of doubles */
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * time_speed - Measure f on params speed_runs times with fsecs, keep
+ *   every measurement in stats and return their median.  The 95%
+ *   confidence interval of the median goes in stats too: the order
+ *   statistics that bound it, by the normal approximation to the
+ *   binomial, which assumes nothing about how the times are spread.
+ *   With fewer than six runs it is their whole range, at less than
+ *   95%.
+ */
+static double time_speed(fsecs_test_funct f, speed_t *params,
+						 stats_t *stats)
+{
+	double sorted[speed_runs], half = 0.98 * sqrt(speed_runs);
+	int i, lo, hi;
+
+	stats->samples = (double *)calloc(speed_runs, sizeof(double));
+	if (stats->samples == NULL)
+		unix_error("calloc failed in time_speed");
+	stats->nsamples = speed_runs;
+	for (i = 0; i < speed_runs; i++)
+		sorted[i] = stats->samples[i] = fsecs(f, params);
+	qsort(sorted, speed_runs, sizeof(double), cmp_double);
+
+	/* ranks counted from 1 */
+	lo = (int)floor(speed_runs / 2.0 - half);
+	hi = (int)ceil(speed_runs / 2.0 + 1 + half);
+	stats->ci_lo = sorted[(lo < 1 ? 1 : lo) - 1];
+	stats->ci_hi = sorted[(hi > speed_runs ? speed_runs : hi) - 1];
+	if (speed_runs % 2)
+		return sorted[speed_runs / 2];
+	return (sorted[speed_runs / 2 - 1] + sorted[speed_runs / 2]) / 2;
+}
+
+/*
+ * pin_cpu - Restrict this process to the CPU it is running on,
+ *   saving its old set of CPUs in *old; returns 0 if it could not
+ */
+static int pin_cpu(cpu_set_t *old)
+{
+	cpu_set_t one;
+	int cpu;
+
+	if (sched_getaffinity(0, sizeof(*old), old) < 0 ||
+		(cpu = sched_getcpu()) < 0)
+		return 0;
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	return sched_setaffinity(0, sizeof(one), &one) == 0;
+}
+
+/*
+ * open_timeline - Create the -U timeline of the trace in filename:
+ *   <base>.util.csv in the current directory, where <base> is the
+ *   file's name without its directory or extension
+ */
+static FILE *open_timeline(const char *filename)
+{
+	char path[MAXPATH];
+	const char *base = strrchr(filename, '/');
+	const char *ext;
+	FILE *fp;
+
+	base = (base != NULL) ? base + 1 : filename;
+	if ((ext = strrchr(base, '.')) == NULL)
+		ext = base + strlen(base);
+	snprintf(path, sizeof(path), "%.*s.util.csv", (int)(ext - base), base);
+	if ((fp = fopen(path, "w")) == NULL)
+	{
+		unix_error(path);
 	}
+	fprintf(fp, "op,payload,heap,mapped,live,free,free_blocks,largest_free,"
+				"extends,splits,coalesces\n");
+	if (verbose > 1)
+		printf("Writing the utilization timeline to %s\n", path);
+	return fp;
+}
 
-	return ((double)max_total_size / (double)mem_heapsize());
+/*
+ * util_sample - Append one timeline row: the requests done so far,
+ *   the payload bytes they left allocated, and the allocator's
+ *   mm_stats counters at that point
+ */
+static void util_sample(FILE *timeline, int opnum, int payload)
+{
+	struct mm_stats st;
+	size_t nfree = 0;
+	int c;
+
+	mm_stats(&st);
+	for (c = 0; c < MM_STATS_CLASSES; c++)
+		nfree += st.free_blocks[c];
+	fprintf(timeline, "%d,%d,%zu,%zu,%zu,%zu,%zu,%zu,%llu,%llu,%llu\n",
+			opnum, payload, st.heap_size, st.mapped_bytes, st.live_bytes,
+			st.free_bytes, nfree, st.largest_free,
+			(unsigned long long)st.extends, (unsigned long long)st.splits,
+			(unsigned long long)st.coalesces);
 }
 
 /*
@@ -869,6 +1897,22 @@ static void eval_mm_speed(void *ptr)
 			trace->blocks[index] = p;
 			break;
 
+		case CALLOC: /* mm_calloc */
+			index = trace->ops[i].index;
+			size = trace->ops[i].size;
+			if ((p = (char *)mm_calloc(1, size)) == NULL)
+				app_error("mm_calloc error in eval_mm_speed");
+			trace->blocks[index] = p;
+			break;
+
+		case MEMALIGN: /* mm_memalign */
+			index = trace->ops[i].index;
+			size = trace->ops[i].size;
+			if ((p = (char *)mm_memalign(trace->ops[i].align, size)) == NULL)
+				app_error("mm_memalign error in eval_mm_speed");
+			trace->blocks[index] = p;
+			break;
+
 		case REALLOC: /* mm_realloc */
 			index = trace->ops[i].index;
 			newsize = trace->ops[i].size;
@@ -884,70 +1928,641 @@ static void eval_mm_speed(void *ptr)
 			mm_free(block);
 			break;
 
+		case ALLOC_BATCH: /* mm_malloc_batch */
+			index = trace->ops[i].index;
+			if (mm_malloc_batch(trace->ops[i].size, trace->ops[i].count,
+								(void **)&trace->blocks[index]) != (size_t)trace->ops[i].count)
+				app_error("mm_malloc_batch error in eval_mm_speed");
+			break;
+
+		case FREE_BATCH: /* mm_free_batch */
+			index = trace->ops[i].index;
+			mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+			break;
+
 		default:
 			app_error("Nonexistent request type in eval_mm_valid");
 		}
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * eval_mm_latency - Replay the trace once more, timing each request
+ *     and adding it to the histogram for its type.  This is a pass of
+ *     its own so the timer reads don't slow down eval_mm_speed.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static void eval_mm_latency(trace_t *trace, lathist_t *lat)
 {
-	int i, newsize;
-	char *p, *newp, *oldp;
+	int i, index;
+	char *p;
+	size_t n;
+	uint64_t start, t0, t1, d, ns0;
+	traceop_t *op;
+
+	/* Reset the heap and initialize the mm package */
+	mem_reset_brk();
+	if (mm_init() < 0)
+		app_error("mm_init failed in eval_mm_latency");
+	if (lat_overhead == 0)
+		lat_calibrate();
 
+	ns0 = lat_clock_ns();
+	start = LAT_NOW();
 	for (i = 0; i < trace->num_ops; i++)
 	{
-		switch (trace->ops[i].type)
+		op = &trace->ops[i];
+		index = op->index;
+		switch (op->type)
 		{
+		case ALLOC: /* mm_malloc */
+			t0 = LAT_NOW();
+			p = (char *)mm_malloc(op->size);
+			t1 = LAT_NOW();
+			if (p == NULL)
+				app_error("mm_malloc error in eval_mm_latency");
+			trace->blocks[index] = p;
+			break;
 
-		case ALLOC: /* malloc */
-			if ((p = (char *)malloc(trace->ops[i].size)) == NULL)
+		case CALLOC: /* mm_calloc */
+			t0 = LAT_NOW();
+			p = (char *)mm_calloc(1, op->size);
+			t1 = LAT_NOW();
+			if (p == NULL)
+				app_error("mm_calloc error in eval_mm_latency");
+			trace->blocks[index] = p;
+			break;
+
+		case MEMALIGN: /* mm_memalign */
+			t0 = LAT_NOW();
+			p = (char *)mm_memalign(op->align, op->size);
+			t1 = LAT_NOW();
+			if (p == NULL)
+				app_error("mm_memalign error in eval_mm_latency");
+			trace->blocks[index] = p;
+			break;
+
+		case REALLOC: /* mm_realloc */
+			t0 = LAT_NOW();
+			p = (char *)mm_realloc(trace->blocks[index], op->size);
+			t1 = LAT_NOW();
+			if (p == NULL)
+				app_error("mm_realloc error in eval_mm_latency");
+			trace->blocks[index] = p;
+			break;
+
+		case FREE: /* mm_free */
+			t0 = LAT_NOW();
+			mm_free(trace->blocks[index]);
+			t1 = LAT_NOW();
+			break;
+
+		case ALLOC_BATCH: /* mm_malloc_batch, timed as a whole */
+			t0 = LAT_NOW();
+			n = mm_malloc_batch(op->size, op->count, (void **)&trace->blocks[index]);
+			t1 = LAT_NOW();
+			if (n != (size_t)op->count)
+				app_error("mm_malloc_batch error in eval_mm_latency");
+			break;
+
+		case FREE_BATCH: /* mm_free_batch, timed as a whole */
+			t0 = LAT_NOW();
+			mm_free_batch((void **)&trace->blocks[index], op->count);
+			t1 = LAT_NOW();
+			break;
+
+		default:
+			app_error("Nonexistent request type in eval_mm_latency");
+			return;
+		}
+
+		/* Charge the request for its time less the cost of the reads */
+		d = t1 - t0;
+		d = (d > lat_overhead) ? d - lat_overhead : 0;
+		lat[op->type].count++;
+		lat[op->type].bucket[LAT_BUCKET(d)]++;
+		if (d > lat[op->type].max)
+			lat[op->type].max = d;
+	}
+	lat_ticks += (double)(LAT_NOW() - start);
+	lat_ns += (double)(lat_clock_ns() - ns0);
+}
+
+/*
+ * eval_mm_threads - Replay the trace on 1, 2, 4, ... max_threads
+ *     threads against one mm heap and print the aggregate and
+ *     per-thread throughput for each thread count.
+ */
+static void eval_mm_threads(trace_t *trace, int tracenum, int max_threads,
+							mtpattern_t pattern)
+{
+	static const char *names[] = {"copies", "split", "handoff"};
+	mtthread_t *threads;
+	mtqueue_t *queues = NULL;
+	double secs, ops, kops, sum, base = 0, lo, hi;
+	int n, k;
+
+	if ((threads = (mtthread_t *)calloc(max_threads, sizeof(mtthread_t))) == NULL)
+		unix_error("calloc failed in eval_mm_threads");
+	for (k = 0; k < max_threads; k++)
+		if ((threads[k].blocks = (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+			unix_error("malloc failed in eval_mm_threads");
+	if (pattern == MT_SPLIT)
+		for (k = 0; k < max_threads; k++)
+			if ((threads[k].ops = (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+				unix_error("malloc failed in eval_mm_threads");
+	if (pattern == MT_HANDOFF &&
+		(queues = (mtqueue_t *)malloc(max_threads * sizeof(mtqueue_t))) == NULL)
+		unix_error("malloc failed in eval_mm_threads");
+
+	printf("\nScaling of trace %d (%s, best of %d runs):\n",
+		   tracenum, names[pattern], MT_RUNS);
+	printf("%7s%10s%8s%10s%10s%10s\n",
+		   "threads", "Kops", "speedup", "min Kops", "avg Kops", "max Kops");
+	for (n = 1; n <= max_threads; n = (n < max_threads && 2 * n > max_threads) ? max_threads : 2 * n)
+	{
+		secs = mt_run(trace, n, pattern, threads, queues);
+
+		/* Aggregate and per-thread throughput of the fastest run */
+		ops = sum = 0;
+		lo = DBL_MAX;
+		hi = 0;
+		for (k = 0; k < n; k++)
+		{
+			ops += threads[k].ops_done;
+			kops = threads[k].ops_done / 1e3 / threads[k].secs;
+			sum += kops;
+			lo = (kops < lo) ? kops : lo;
+			hi = (kops > hi) ? kops : hi;
+		}
+		kops = ops / 1e3 / secs;
+		if (n == 1)
+			base = kops;
+		printf("%7d%10.0f%7.2fx%10.0f%10.0f%10.0f\n",
+			   n, kops, kops / base, lo, sum / n, hi);
+		if (n == max_threads)
+			break;
+	}
+
+	for (k = 0; k < max_threads; k++)
+	{
+		free(threads[k].blocks);
+		if (pattern == MT_SPLIT)
+			free(threads[k].ops);
+	}
+	free(threads);
+	free(queues);
+}
+
+/*
+ * mt_run - Replay the trace MT_RUNS times on nthreads threads and
+ *     return the time of the fastest run, whose per-thread results are
+ *     left in threads[].
+ */
+static double mt_run(trace_t *trace, int nthreads, mtpattern_t pattern,
+					 mtthread_t *threads, mtqueue_t *queues)
+{
+	mtthread_t best[nthreads];
+	double secs, best_secs = DBL_MAX;
+	uint64_t start, end;
+	traceop_t op;
+	int r, k, i, lo, hi, first, last;
+
+	/* Give each thread its share of the trace */
+	for (k = 0; k < nthreads; k++)
+	{
+		if (pattern != MT_SPLIT)
+		{
+			threads[k].ops = trace->ops;
+			threads[k].num_ops = trace->num_ops;
+			continue;
+		}
+		lo = (int)((long)trace->num_ids * k / nthreads);
+		hi = (int)((long)trace->num_ids * (k + 1) / nthreads);
+		threads[k].num_ops = 0;
+		for (i = 0; i < trace->num_ops; i++)
+		{
+			op = trace->ops[i];
+			if (op.type == ALLOC_BATCH || op.type == FREE_BATCH)
+			{
+				/* clip a batch to this thread's ids */
+				first = (op.index > lo) ? op.index : lo;
+				last = (op.index + op.count < hi) ? op.index + op.count : hi;
+				if (first >= last)
+					continue;
+				op.index = first;
+				op.count = last - first;
+			}
+			else if (op.index < lo || op.index >= hi)
+				continue;
+			threads[k].ops[threads[k].num_ops++] = op;
+		}
+	}
+
+	for (r = 0; r < MT_RUNS; r++)
+	{
+		/* Reset the heap and initialize the mm package */
+		mem_reset_brk();
+		if (mm_init() < 0)
+			app_error("mm_init failed in mt_run");
+
+		pthread_barrier_init(&mt_barrier, NULL, nthreads);
+		for (k = 0; k < nthreads; k++)
+		{
+			threads[k].in = threads[k].out = NULL;
+			if (pattern == MT_HANDOFF)
 			{
-				malloc_error(tracenum, i, "libc malloc failed");
-				unix_error("System message");
+				memset(&queues[k], 0, sizeof(mtqueue_t));
+				threads[k].out = &queues[k];
+				threads[k].in = &queues[(k + nthreads - 1) % nthreads];
 			}
+		}
+		for (k = 0; k < nthreads; k++)
+			if ((errno = pthread_create(&threads[k].tid, NULL, mt_replay, &threads[k])) != 0)
+				unix_error("pthread_create failed in mt_run");
+
+		/* 
+		 * The run lasts from the first thread starting to the last one
+		 * finishing, and a thread is charged from the start of the run
+		 * so threads that wait to be scheduled don't look faster
+		 */
+		start = UINT64_MAX;
+		end = 0;
+		for (k = 0; k < nthreads; k++)
+		{
+			pthread_join(threads[k].tid, NULL);
+			start = (threads[k].start < start) ? threads[k].start : start;
+			end = (threads[k].end > end) ? threads[k].end : end;
+		}
+		pthread_barrier_destroy(&mt_barrier);
+		for (k = 0; k < nthreads; k++)
+			threads[k].secs = (threads[k].end - start) / 1e9;
+		secs = (end - start) / 1e9;
+
+		if (secs < best_secs)
+		{
+			best_secs = secs;
+			memcpy(best, threads, sizeof(best));
+		}
+	}
+	memcpy(threads, best, sizeof(best));
+	return best_secs;
+}
+
+/*
+ * mt_replay - Thread body of a multithreaded replay. With a handoff
+ *     queue, frees go to the next thread instead, and the thread frees
+ *     the blocks the previous one hands it until that one is done.
+ */
+static void *mt_replay(void *arg)
+{
+	mtthread_t *t = (mtthread_t *)arg;
+	traceop_t *op;
+	char *p;
+	int i, b, n, done;
+
+	t->ops_done = 0;
+	pthread_barrier_wait(&mt_barrier);
+	t->start = lat_clock_ns();
+
+	for (i = 0; i < t->num_ops; i++)
+	{
+		op = &t->ops[i];
+		switch (op->type)
+		{
+		case ALLOC: /* mm_malloc */
+			if ((p = (char *)mm_malloc(op->size)) == NULL)
+				app_error("mm_malloc failed in mt_replay (heap too small?)");
+			t->blocks[op->index] = p;
+			break;
+
+		case CALLOC: /* mm_calloc */
+			if ((p = (char *)mm_calloc(1, op->size)) == NULL)
+				app_error("mm_calloc failed in mt_replay (heap too small?)");
+			t->blocks[op->index] = p;
+			break;
+
+		case MEMALIGN: /* mm_memalign */
+			if ((p = (char *)mm_memalign(op->align, op->size)) == NULL)
+				app_error("mm_memalign failed in mt_replay (heap too small?)");
+			t->blocks[op->index] = p;
+			break;
+
+		case REALLOC: /* mm_realloc */
+			if ((p = (char *)mm_realloc(t->blocks[op->index], op->size)) == NULL)
+				app_error("mm_realloc failed in mt_replay (heap too small?)");
+			t->blocks[op->index] = p;
+			break;
+
+		case FREE: /* mm_free, here or on the next thread */
+		case FREE_BATCH: /* mm_free_batch, or block by block on the next thread */
+			if (t->out == NULL)
+			{
+				if (op->type == FREE)
+					mm_free(t->blocks[op->index]);
+				else
+					mm_free_batch((void **)&t->blocks[op->index], op->count);
+				break;
+			}
+			for (b = op->index; b < op->index + OP_BLOCKS(op); b++)
+				while (!mt_push(t->out, t->blocks[b]))
+				{
+					/* the queue is full, so give the consumer a turn */
+					if ((n = mt_drain(t->in)) == 0)
+						sched_yield();
+					t->ops_done += n;
+				}
+			continue;
+
+		case ALLOC_BATCH: /* mm_malloc_batch */
+			if (mm_malloc_batch(op->size, op->count, (void **)&t->blocks[op->index]) !=
+				(size_t)op->count)
+				app_error("mm_malloc_batch failed in mt_replay (heap too small?)");
+			break;
+
+		default:
+			app_error("Nonexistent request type in mt_replay");
+		}
+		t->ops_done += OP_BLOCKS(op);
+		if (t->in != NULL && i % MT_DRAIN == 0)
+			t->ops_done += mt_drain(t->in);
+	}
+
+	/* Let the next thread finish, and finish for the previous one */
+	if (t->out != NULL)
+	{
+		__atomic_store_n(&t->out->done, 1, __ATOMIC_RELEASE);
+		do
+		{
+			done = __atomic_load_n(&t->in->done, __ATOMIC_ACQUIRE);
+			if ((n = mt_drain(t->in)) == 0 && !done)
+				sched_yield();
+			t->ops_done += n;
+		} while (!done || n != 0);
+	}
+
+	t->end = lat_clock_ns();
+	return NULL;
+}
+
+/*
+ * mt_push - Queue block p for the consumer of q to free. Returns 0
+ *     if q is full.
+ */
+static int mt_push(mtqueue_t *q, char *p)
+{
+	unsigned head = q->head;
+
+	if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == MT_QUEUE)
+		return 0;
+	q->slot[head % MT_QUEUE] = p;
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/*
+ * mt_drain - Free every block waiting in q, returning how many
+ */
+static int mt_drain(mtqueue_t *q)
+{
+	unsigned tail = q->tail;
+	unsigned head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	int n = (int)(head - tail);
+
+	for (; tail != head; tail++)
+		mm_free(q->slot[tail % MT_QUEUE]);
+	__atomic_store_n(&q->tail, tail, __ATOMIC_RELEASE);
+	return n;
+}
+
+/*
+ * libc_init - libc malloc can't start over, so there is nothing to do
+ */
+static int libc_init(void)
+{
+	return 0;
+}
+
+/*
+ * load_backend - dlopen the allocator at path and return its
+ *    mm_backend table (see backend.h), or exit if it hasn't one.
+ *    A path without a slash is taken relative to the current
+ *    directory, not searched for.
+ */
+static const mm_backend_t *load_backend(const char *path)
+{
+	char local[MAXPATH];
+	const mm_backend_t *vt;
+	void *handle;
+
+	if (strchr(path, '/') == NULL)
+	{
+		snprintf(local, sizeof(local), "./%s", path);
+		path = local;
+	}
+	if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL)
+	{
+		fprintf(stderr, "mdriver: %s\n", dlerror());
+		exit(1);
+	}
+	if ((vt = (const mm_backend_t *)dlsym(handle, "mm_backend")) == NULL)
+	{
+		fprintf(stderr, "mdriver: %s exports no mm_backend\n", path);
+		exit(1);
+	}
+	if (vt->abi != MM_BACKEND_ABI || vt->init == NULL || vt->malloc == NULL ||
+		vt->free == NULL || vt->realloc == NULL)
+	{
+		fprintf(stderr, "mdriver: %s: mm_backend is not a version %d table\n",
+				path, MM_BACKEND_ABI);
+		exit(1);
+	}
+	return vt;
+}
+
+/*
+ * backend_calloc - vt's calloc, or malloc and memset if it has none
+ */
+static inline void *backend_calloc(const mm_backend_t *vt, size_t size)
+{
+	void *p;
+
+	if (vt->calloc != NULL)
+		return vt->calloc(1, size);
+	if ((p = vt->malloc(size)) != NULL)
+		memset(p, 0, size);
+	return p;
+}
+
+/*
+ * eval_backend_valid - We run this function to make sure that an
+ *    allocator besides mm.c (libc malloc or a -b backend) can run to
+ *    completion on the set of traces. Unlike with mm.c, a failed
+ *    request only disqualifies the trace; it isn't counted as an
+ *    error of the student's package.
+ */
+static int eval_backend_valid(const mm_backend_t *vt, trace_t *trace,
+							  int tracenum, const char *name)
+{
+	int i, k, newsize;
+	char *p, *newp, *oldp;
+	const char *what = NULL;
+
+	if (vt->init() < 0)
+	{
+		printf("ERROR [trace %d]: %s init failed\n", tracenum, name);
+		return 0;
+	}
+
+	for (i = 0; i < trace->num_ops && what == NULL; i++)
+	{
+		switch (trace->ops[i].type)
+		{
+
+		case ALLOC: /* malloc */
+			if ((p = (char *)vt->malloc(trace->ops[i].size)) == NULL)
+				what = "malloc failed";
 			trace->blocks[trace->ops[i].index] = p;
 			break;
 
+		case CALLOC: /* calloc */
+			if ((p = (char *)backend_calloc(vt, trace->ops[i].size)) == NULL)
+				what = "calloc failed";
+			trace->blocks[trace->ops[i].index] = p;
+			break;
+
+		case MEMALIGN: /* memalign */
+			if (vt->memalign == NULL)
+				what = "has no memalign";
+			else if ((p = (char *)vt->memalign(trace->ops[i].align,
+											   trace->ops[i].size)) == NULL)
+				what = "memalign failed";
+			else
+				trace->blocks[trace->ops[i].index] = p;
+			break;
+
 		case REALLOC: /* realloc */
 			newsize = trace->ops[i].size;
 			oldp = trace->blocks[trace->ops[i].index];
-			if ((newp = (char *)realloc(oldp, newsize)) == NULL)
-			{
-				malloc_error(tracenum, i, "libc realloc failed");
-				unix_error("System message");
-			}
-			trace->blocks[trace->ops[i].index] = newp;
+			if ((newp = (char *)vt->realloc(oldp, newsize)) == NULL)
+				what = "realloc failed";
+			else
+				trace->blocks[trace->ops[i].index] = newp;
 			break;
 
 		case FREE: /* free */
-			free(trace->blocks[trace->ops[i].index]);
+			vt->free(trace->blocks[trace->ops[i].index]);
+			break;
+
+		case ALLOC_BATCH: /* malloc, block by block */
+			for (k = 0; k < trace->ops[i].count && what == NULL; k++)
+				if ((trace->blocks[trace->ops[i].index + k] =
+						 (char *)vt->malloc(trace->ops[i].size)) == NULL)
+					what = "malloc failed";
+			break;
+
+		case FREE_BATCH: /* free, block by block */
+			for (k = 0; k < trace->ops[i].count; k++)
+				vt->free(trace->blocks[trace->ops[i].index + k]);
 			break;
 
 		default:
-			app_error("invalid operation type  in eval_libc_valid");
+			app_error("invalid operation type  in eval_backend_valid");
 		}
 	}
 
+	if (what != NULL)
+	{
+		printf("ERROR [trace %d, line %d]: %s %s\n",
+			   tracenum, LINENUM(i - 1), name, what);
+		return 0;
+	}
 	return 1;
 }
 
+/*
+ * eval_backend_util - Evaluate the space utilization of an allocator
+ *    with stats, as eval_mm_util does for mm.c: the peak payload over
+ *    the peak footprint (heap_size plus mapped_bytes), which is
+ *    sampled after every request.
+ */
+static double eval_backend_util(const mm_backend_t *vt, trace_t *trace)
+{
+	int i, k, index, size;
+	size_t total_size = 0, max_total_size = 0, foot, max_foot = 0;
+	struct mm_stats st;
+
+	if (vt->init() < 0)
+		app_error("backend init failed in eval_backend_util");
+
+	for (i = 0; i < trace->num_ops; i++)
+	{
+		index = trace->ops[i].index;
+		size = trace->ops[i].size;
+		switch (trace->ops[i].type)
+		{
+		case ALLOC:
+		case CALLOC:
+		case MEMALIGN:
+			if (trace->ops[i].type == CALLOC)
+				trace->blocks[index] = (char *)backend_calloc(vt, size);
+			else if (trace->ops[i].type == MEMALIGN)
+				trace->blocks[index] = (char *)vt->memalign(trace->ops[i].align, size);
+			else
+				trace->blocks[index] = (char *)vt->malloc(size);
+			trace->block_sizes[index] = size;
+			total_size += size;
+			break;
+		case REALLOC:
+			trace->blocks[index] = (char *)vt->realloc(trace->blocks[index], size);
+			total_size += size - trace->block_sizes[index];
+			trace->block_sizes[index] = size;
+			break;
+		case FREE:
+			vt->free(trace->blocks[index]);
+			total_size -= trace->block_sizes[index];
+			break;
+		case ALLOC_BATCH:
+			for (k = index; k < index + trace->ops[i].count; k++)
+			{
+				trace->blocks[k] = (char *)vt->malloc(size);
+				trace->block_sizes[k] = size;
+			}
+			total_size += (size_t)size * trace->ops[i].count;
+			break;
+		case FREE_BATCH:
+			for (k = index; k < index + trace->ops[i].count; k++)
+			{
+				vt->free(trace->blocks[k]);
+				total_size -= trace->block_sizes[k];
+			}
+			break;
+		}
+
+		if (total_size > max_total_size)
+			max_total_size = total_size;
+		vt->stats(&st);
+		foot = st.heap_size + st.mapped_bytes;
+		if (foot > max_foot)
+			max_foot = foot;
+	}
+
+	return max_foot > 0 ? (double)max_total_size / (double)max_foot : 0;
+}
+
 /* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+ * eval_backend_speed - This is the function that is used by fcyc()
+ *    to measure the running time of libc malloc or a -b backend on
+ *    the set of traces.
  */
-static void eval_libc_speed(void *ptr)
+static void eval_backend_speed(void *ptr)
 {
-	int i;
+	int i, k;
 	int index, size, newsize;
 	char *p, *newp, *oldp, *block;
 	trace_t *trace = ((speed_t *)ptr)->trace;
+	const mm_backend_t *vt = ((speed_t *)ptr)->backend;
+
+	if (vt->init() < 0)
+		app_error("backend init failed in eval_backend_speed");
 
 	for (i = 0; i < trace->num_ops; i++)
 	{
@@ -956,8 +2571,24 @@ static void eval_libc_speed(void *ptr)
 		case ALLOC: /* malloc */
 			index = trace->ops[i].index;
 			size = trace->ops[i].size;
-			if ((p = (char *)malloc(size)) == NULL)
-				unix_error("malloc failed in eval_libc_speed");
+			if ((p = (char *)vt->malloc(size)) == NULL)
+				unix_error("malloc failed in eval_backend_speed");
+			trace->blocks[index] = p;
+			break;
+
+		case CALLOC: /* calloc */
+			index = trace->ops[i].index;
+			size = trace->ops[i].size;
+			if ((p = (char *)backend_calloc(vt, size)) == NULL)
+				unix_error("calloc failed in eval_backend_speed");
+			trace->blocks[index] = p;
+			break;
+
+		case MEMALIGN: /* memalign */
+			index = trace->ops[i].index;
+			size = trace->ops[i].size;
+			if ((p = (char *)vt->memalign(trace->ops[i].align, size)) == NULL)
+				unix_error("memalign failed in eval_backend_speed");
 			trace->blocks[index] = p;
 			break;
 
@@ -965,8 +2596,8 @@ static void eval_libc_speed(void *ptr)
 			index = trace->ops[i].index;
 			newsize = trace->ops[i].size;
 			oldp = trace->blocks[index];
-			if ((newp = (char *)realloc(oldp, newsize)) == NULL)
-				unix_error("realloc failed in eval_libc_speed\n");
+			if ((newp = (char *)vt->realloc(oldp, newsize)) == NULL)
+				unix_error("realloc failed in eval_backend_speed\n");
 
 			trace->blocks[index] = newp;
 			break;
@@ -974,7 +2605,20 @@ static void eval_libc_speed(void *ptr)
 		case FREE: /* free */
 			index = trace->ops[i].index;
 			block = trace->blocks[index];
-			free(block);
+			vt->free(block);
+			break;
+
+		case ALLOC_BATCH: /* malloc, block by block */
+			index = trace->ops[i].index;
+			for (k = 0; k < trace->ops[i].count; k++)
+				if ((trace->blocks[index + k] = (char *)vt->malloc(trace->ops[i].size)) == NULL)
+					unix_error("malloc failed in eval_backend_speed");
+			break;
+
+		case FREE_BATCH: /* free, block by block */
+			index = trace->ops[i].index;
+			for (k = 0; k < trace->ops[i].count; k++)
+				vt->free(trace->blocks[index + k]);
 			break;
 		}
 	}
@@ -989,19 +2633,42 @@ static void eval_libc_speed(void *ptr)
  */
 static void printresults(int n, stats_t *stats)
 {
-	int i;
+	int i, t;
 	double secs = 0;
 	double ops = 0;
 	double util = 0;
+	int lat = 0, counted = 0, ci = 0;
+	static lathist_t all, total;
+	double perf[PERFCTR_NEVENTS] = {0};
+
+	/* 
+	 * With -r, the 95% confidence interval of Kops follows Kops; with
+	 * -L, the latency over all types of request; and with -C, the IPC
+	 * and the misses per request
+	 */
+	for (i = 0; i < n; i++)
+	{
+		ci |= (stats[i].nsamples > 1);
+		lat |= (stats[i].lat != NULL);
+		counted |= stats[i].counted;
+	}
+	memset(&total, 0, sizeof(total));
 
 	/* Print the individual results for each trace */
-	printf("%5s%7s %5s%8s%10s%6s\n",
+	printf("%5s%7s %5s%8s%10s%6s",
 		   "trace", " valid", "util", "ops", "secs", "Kops");
+	if (ci)
+		printf("%14s", "95% CI");
+	if (lat)
+		printf("%8s%8s%8s", "p50", "p99", "p99.9");
+	if (counted)
+		printf("%6s%8s%8s%8s%8s", "IPC", "L1d/op", "LLC/op", "TLB/op", "br/op");
+	printf("\n");
 	for (i = 0; i < n; i++)
 	{
 		if (stats[i].valid)
 		{
-			printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n",
+			printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f",
 				   i,
 				   "yes",
 				   stats[i].util * 100.0,
@@ -1011,6 +2678,28 @@ static void printresults(int n, stats_t *stats)
 			secs += stats[i].secs;
 			ops += stats[i].ops;
 			util += stats[i].util;
+			if (ci)
+				printf("%7.0f-%-6.0f",
+					   (stats[i].ops / 1e3) / stats[i].ci_hi,
+					   (stats[i].ops / 1e3) / stats[i].ci_lo);
+			if (stats[i].lat != NULL)
+			{
+				memset(&all, 0, sizeof(all));
+				for (t = 0; t < LAT_TYPES; t++)
+					lat_merge(&all, &stats[i].lat[t]);
+				lat_merge(&total, &all);
+				printf("%8.0f%8.0f%8.0f",
+					   lat_percentile(&all, 0.50),
+					   lat_percentile(&all, 0.99),
+					   lat_percentile(&all, 0.999));
+			}
+			if (stats[i].counted)
+			{
+				for (t = 0; t < PERFCTR_NEVENTS; t++)
+					perf[t] += stats[i].perf[t];
+				printperf(stats[i].perf, stats[i].ops);
+			}
+			printf("\n");
 		}
 		else
 		{
@@ -1027,12 +2716,22 @@ static void printresults(int n, stats_t *stats)
 	/* Print the aggregate results for the set of traces */
 	if (errors == 0)
 	{
-		printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n",
+		printf("%12s%5.0f%%%8.0f%10.6f%6.0f",
 			   "Total       ",
 			   (util / n) * 100.0,
 			   ops,
 			   secs,
 			   (ops / 1e3) / secs);
+		if (ci)
+			printf("%14s", "");
+		if (lat)
+			printf("%8.0f%8.0f%8.0f",
+				   lat_percentile(&total, 0.50),
+				   lat_percentile(&total, 0.99),
+				   lat_percentile(&total, 0.999));
+		if (counted)
+			printperf(perf, ops);
+		printf("\n");
 	}
 	else
 	{
@@ -1045,6 +2744,274 @@ static void printresults(int n, stats_t *stats)
 	}
 }
 
+/*
+ * lat_bucket - Histogram bucket of a latency of LAT_SUB ticks or more:
+ *     the power of two it falls in picks a group of LAT_SUB buckets,
+ *     and the LAT_SUB_BITS bits below the leading one pick the bucket
+ *     within the group.
+ */
+static inline int lat_bucket(uint64_t v)
+{
+	int e = 63 - __builtin_clzll(v);
+
+	return ((e - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+		   (int)((v >> (e - LAT_SUB_BITS)) - LAT_SUB);
+}
+
+/*
+ * lat_clock_ns - Read the monotonic clock in nanoseconds
+ */
+static uint64_t lat_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * lat_calibrate - Measure what two back-to-back timer reads cost, so
+ *     that can be taken off every sample.  The minimum of a few tries
+ *     is the cost with nothing getting in the way.
+ */
+static void lat_calibrate(void)
+{
+	uint64_t t0, t1, best = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < 1000; i++)
+	{
+		t0 = LAT_NOW();
+		t1 = LAT_NOW();
+		if (t1 - t0 < best)
+			best = t1 - t0;
+	}
+	lat_overhead = (best > 0) ? best : 1;
+}
+
+/*
+ * lat_percentile - Return the q-th quantile of histogram h in
+ *     nanoseconds.  This is the top of the bucket the quantile falls
+ *     in, so it errs high by at most the bucket width.
+ */
+static double lat_percentile(const lathist_t *h, double q)
+{
+	uint64_t rank, seen = 0, hi;
+	double scale = (lat_ticks > 0) ? lat_ns / lat_ticks : 1.0;
+	int b;
+
+	if (h->count == 0)
+		return 0;
+	rank = (uint64_t)(q * h->count);
+	if (rank < 1)
+		rank = 1;
+	for (b = 0; b < LAT_BUCKETS - 1; b++)
+	{
+		seen += h->bucket[b];
+		if (seen >= rank)
+			break;
+	}
+	hi = (b + 1 < LAT_BUCKETS) ? LAT_BUCKET_LO(b + 1) - 1 : h->max;
+	if (hi > h->max)
+		hi = h->max;
+	return hi * scale;
+}
+
+/*
+ * lat_merge - Add the samples in histogram src to dst
+ */
+static void lat_merge(lathist_t *dst, const lathist_t *src)
+{
+	int b;
+
+	dst->count += src->count;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	for (b = 0; b < LAT_BUCKETS; b++)
+		dst->bucket[b] += src->bucket[b];
+}
+
+/*
+ * printcompare - prints the totals of mm.c next to those of libc
+ *     malloc and the -b backends, one line per allocator. An
+ *     allocator's totals only cover the traces it ran correctly.
+ */
+static void printcompare(int n, alloc_t *allocs, int nallocs, stats_t *mm)
+{
+	int i, j, valid;
+	double secs, ops, util;
+	stats_t *stats;
+	const char *name;
+
+	printf("%-16s%6s%6s%10s%7s\n", "allocator", "valid", "util", "secs", "Kops");
+	for (j = -1; j < nallocs; j++)
+	{
+		name = (j < 0) ? "mm.c" : allocs[j].name;
+		stats = (j < 0) ? mm : allocs[j].stats;
+		secs = ops = util = 0;
+		valid = 0;
+		for (i = 0; i < n; i++)
+		{
+			if (!stats[i].valid)
+				continue;
+			valid++;
+			secs += stats[i].secs;
+			ops += stats[i].ops;
+			util += stats[i].util;
+		}
+		if (valid == 0)
+			printf("%-16s%3d/%-2d%6s%10s%7s\n", name, valid, n, "-", "-", "-");
+		else
+			printf("%-16s%3d/%-2d%5.0f%%%10.6f%7.0f\n", name, valid, n,
+				   (util / valid) * 100.0, secs, (ops / 1e3) / secs);
+	}
+}
+
+/*
+ * printjson - writes the results of mm.c and of libc malloc and the
+ *     -b backends to path ("-" for stdout) as JSON, for regression
+ *     tracking (see regress-malloc.py).  Each allocator gets a list of
+ *     traces with every speed measurement in "secs", their median and
+ *     its confidence interval; invalid traces carry none of these or
+ *     util.  "timing" says how the measurements were taken.
+ */
+static void printjson(const char *path, char **tracefiles, int n,
+					  alloc_t *allocs, int nallocs, stats_t *mm,
+					  double perfindex)
+{
+	FILE *fp = strcmp(path, "-") ? fopen(path, "w") : stdout;
+	const char *name, *c;
+	stats_t *stats;
+	int i, j, k;
+
+	if (fp == NULL)
+		unix_error(path);
+	fprintf(fp, "{\n  \"perfidx\": %.0f,\n  \"errors\": %d,\n"
+				"  \"speed_runs\": %d,\n  \"timing\": {\"method\": \"%s\", "
+				"\"cache\": \"%s\", \"flush_bytes\": %d, \"kbest\": %d},\n"
+				"  \"allocators\": {",
+			perfindex, errors, speed_runs, fsecs_names[timer],
+			fsecs_cold() ? "cold" : "warm", fsecs_cold() ? fsecs_flush_bytes() : 0, kbest);
+	for (j = -1; j < nallocs; j++)
+	{
+		name = (j < 0) ? "mm.c" : allocs[j].name;
+		stats = (j < 0) ? mm : allocs[j].stats;
+		fprintf(fp, "%s\n    \"%s\": [", j < 0 ? "" : ",", name);
+		for (i = 0; i < n; i++)
+		{
+			fprintf(fp, "%s\n      {\"trace\": \"", i ? "," : "");
+			for (c = tracefiles[i]; *c != '\0'; c++)
+				fprintf(fp, (*c == '"' || *c == '\\') ? "\\%c" : "%c", *c);
+			fprintf(fp, "\", \"ops\": %.0f, \"valid\": %s",
+					stats[i].ops, stats[i].valid ? "true" : "false");
+			if (stats[i].valid)
+			{
+				fprintf(fp, ", \"util\": %.6f, \"secs\": [", stats[i].util);
+				for (k = 0; k < stats[i].nsamples; k++)
+					fprintf(fp, "%s%.9f", k ? ", " : "", stats[i].samples[k]);
+				fprintf(fp, "], \"median\": %.9f, \"ci\": [%.9f, %.9f]",
+						stats[i].secs, stats[i].ci_lo, stats[i].ci_hi);
+			}
+			fprintf(fp, "}");
+		}
+		fprintf(fp, "\n    ]");
+	}
+	fprintf(fp, "\n  }\n}\n");
+	if (fp != stdout && fclose(fp) != 0)
+		unix_error(path);
+}
+
+/*
+ * printperf - prints the IPC and the misses per request of one row of
+ *     printresults, given the hardware event counts for ops requests.
+ *     Events that weren't counted print as "-".
+ */
+static void printperf(double perf[PERFCTR_NEVENTS], double ops)
+{
+	static const int misses[] = {PERFCTR_L1D_MISSES, PERFCTR_LLC_MISSES,
+								 PERFCTR_DTLB_MISSES, PERFCTR_BRANCH_MISSES};
+	int i;
+
+	if (perf[PERFCTR_CYCLES] > 0 && perf[PERFCTR_INSTRUCTIONS] >= 0)
+		printf("%6.2f", perf[PERFCTR_INSTRUCTIONS] / perf[PERFCTR_CYCLES]);
+	else
+		printf("%6s", "-");
+	for (i = 0; i < 4; i++)
+	{
+		if (perf[misses[i]] >= 0)
+			printf("%8.3f", perf[misses[i]] / ops);
+		else
+			printf("%8s", "-");
+	}
+}
+
+/*
+ * printmmstats - prints the mm_stats counters as the utilization run
+ *     left them, at the end of the trace
+ */
+static void printmmstats(void)
+{
+	struct mm_stats st;
+	size_t nfree = 0;
+	int c;
+
+	mm_stats(&st);
+	for (c = 0; c < MM_STATS_CLASSES; c++)
+		nfree += st.free_blocks[c];
+	printf("  heap %zu, mapped %zu, live %zu, free %zu in %zu blocks (largest %zu)\n",
+		   st.heap_size, st.mapped_bytes, st.live_bytes, st.free_bytes,
+		   nfree, st.largest_free);
+	printf("  %llu extends, %llu splits, %llu coalesces, "
+		   "reallocs %llu in place and %llu copied\n",
+		   (unsigned long long)st.extends, (unsigned long long)st.splits,
+		   (unsigned long long)st.coalesces,
+		   (unsigned long long)st.realloc_in_place,
+		   (unsigned long long)st.realloc_copies);
+}
+
+/*
+ * printlatency - prints the latency percentiles of each request type
+ *     for each trace measured with -L, in nanoseconds
+ */
+static void printlatency(int n, stats_t *stats)
+{
+	static const char *names[LAT_TYPES] = {"malloc", "free", "realloc",
+												"calloc", "memalign",
+												"mbatch", "fbatch"};
+	static lathist_t total[LAT_TYPES];
+	double scale = (lat_ticks > 0) ? lat_ns / lat_ticks : 1.0;
+	const lathist_t *h;
+	int i, t;
+
+	printf("Request latency (ns):\n");
+	printf("%5s %-8s%9s%8s%8s%8s%10s\n",
+		   "trace", "request", "ops", "p50", "p99", "p99.9", "max");
+	for (i = 0; i <= n; i++)
+	{
+		if (i < n && stats[i].lat == NULL)
+			continue;
+		for (t = 0; t < LAT_TYPES; t++)
+		{
+			h = (i < n) ? &stats[i].lat[t] : &total[t];
+			if (i < n)
+				lat_merge(&total[t], h);
+			if (h->count == 0)
+				continue;
+			if (i < n)
+				printf("%5d ", i);
+			else
+				printf("%5s ", "Total");
+			printf("%-8s%9llu%8.0f%8.0f%8.0f%10.0f\n",
+				   names[t],
+				   (unsigned long long)h->count,
+				   lat_percentile(h, 0.50),
+				   lat_percentile(h, 0.99),
+				   lat_percentile(h, 0.999),
+				   h->max * scale);
+		}
+	}
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1072,19 +3039,85 @@ void malloc_error(int tracenum, int opnum, const char *msg)
 	printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * parse_size - Convert a byte count with an optional k, m or g suffix;
+ *     returns 0 if arg is not one
+ */
+static size_t parse_size(const char *arg)
+{
+	char *end;
+	unsigned long long n;
+	int shift = 0;
+
+	errno = 0;
+	n = strtoull(arg, &end, 10);
+	if (errno != 0 || end == arg || *arg == '-')
+		return 0;
+	switch (*end)
+	{
+	case 'k':
+	case 'K':
+		shift = 10;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		shift = 20;
+		end++;
+		break;
+	case 'g':
+	case 'G':
+		shift = 30;
+		end++;
+		break;
+	}
+	if (*end != '\0' || n > (SIZE_MAX >> shift))
+		return 0;
+	return (size_t)n << shift;
+}
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void)
 {
-	fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+	fprintf(stderr, "Usage: mdriver [-hvValLC] [-f <file>] [-t <dir>] [-H <size>]\n");
+	fprintf(stderr, "               [-T <n> [-P <pat>]] [-U <n>] [-b <lib.so>]...\n");
+	fprintf(stderr, "               [-p <n>] [-r <n>] [-J <file>]\n");
+	fprintf(stderr, "               [-m <timer>] [-c <cache>] [-k <n>]\n");
 	fprintf(stderr, "Options\n");
 	fprintf(stderr, "\t-a         Don't check the team structure.\n");
+	fprintf(stderr, "\t-b <lib>   Also run the allocator in shared object <lib>\n");
+	fprintf(stderr, "\t           (see backend.h) and compare it with mm.c.\n");
+	fprintf(stderr, "\t-c <cache> Time with warm caches (warm) or flush them before\n");
+	fprintf(stderr, "\t           each run (cold, or cold:<size> to read <size>\n");
+	fprintf(stderr, "\t           bytes; default twice the LLC).  Default cold with\n");
+	fprintf(stderr, "\t           -m cycles, warm with the other timers.\n");
+	fprintf(stderr, "\t-C         Report IPC and cache, TLB and branch misses per request.\n");
 	fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
 	fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
 	fprintf(stderr, "\t-h         Print this message.\n");
+	fprintf(stderr, "\t-H <size>  Limit the heap to <size> bytes (suffix k, m\n");
+	fprintf(stderr, "\t           or g; default %d MB).\n", MAX_HEAP >> 20);
+	fprintf(stderr, "\t-J <file>  Write the results to <file> (- for stdout) as\n");
+	fprintf(stderr, "\t           JSON, for regress-malloc.py.\n");
+	fprintf(stderr, "\t-k <n>     Take each measurement as the fastest of <n> runs\n");
+	fprintf(stderr, "\t           that agree within 1%% (K-best).\n");
 	fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+	fprintf(stderr, "\t-L         Report per-request latency percentiles (ns).\n");
+	fprintf(stderr, "\t-m <timer> Time with cycles, itimer or gettod (default %s).\n",
+			fsecs_names[FSECS_DEFAULT]);
+	fprintf(stderr, "\t-p <n>     Check validity and util in <n> worker processes,\n");
+	fprintf(stderr, "\t           then time the traces one by one on one CPU.\n");
+	fprintf(stderr, "\t-P <pat>   How -T threads share a trace: copies (each\n");
+	fprintf(stderr, "\t           replays all of it), split (by block id) or\n");
+	fprintf(stderr, "\t           handoff (copies, freed by the next thread).\n");
+	fprintf(stderr, "\t-r <n>     Time each trace <n> times and report the median\n");
+	fprintf(stderr, "\t           and its 95%% confidence interval.\n");
 	fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+	fprintf(stderr, "\t-T <n>     Measure scaling on 1, 2, 4, ... n threads.\n");
+	fprintf(stderr, "\t-U <n>     Sample heap use every <n> requests of the\n");
+	fprintf(stderr, "\t           utilization run into <trace>.util.csv.\n");
 	fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
 	fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -3,6 +3,7 @@
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
  */
+#define _GNU_SOURCE             /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,6 +11,9 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
 
 #include "memlib.h"
 #include "config.h"
@@ -18,20 +22,157 @@
 char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_fresh_brk;  /* nothing from here up has been in the heap */
+static size_t mem_mapped;    /* bytes in mem_map mappings */
+static size_t mem_peak;      /* largest footprint since the last reset */
+static size_t mem_limit = MAX_HEAP;  /* heap size limit (bytes) */
+/*
+ * Mappings handed out by mem_map, so that mem_mapped_range can check
+ * pointers into them and mem_reset_brk can drop them.  There are few
+ * of them (one per huge block), so an unsorted array will do.
+ */
+typedef struct {
+    char *lo;
+    size_t len;
+} mem_mapping_t;
+
+static mem_mapping_t *mem_maps;
+static int mem_nmaps, mem_maxmaps;
+static pthread_mutex_t mem_maps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * A heap image, as mem_save writes it: this header and the mappings
+ * on one page, then the heap and each mapping, page aligned, in
+ * that order.
+ */
+#define MEM_IMAGE_MAGIC 0x6d656d696d673031ULL   /* "memimg01" */
+
+typedef struct {
+    uint64_t magic;
+    char *base;                 /* mem_start_brk */
+    size_t heap;                /* bytes below the break */
+    size_t limit;               /* mem_limit */
+    int nmaps;                  /* mappings that follow */
+} mem_image_t;
+
+#if USE_MEM_MMAP
+static char *mem_map_start;  /* start of the reserved mapping */
+static size_t mem_map_size;  /* length of the reserved mapping */
+static char *mem_commit_brk; /* end of the accessible part of the heap */
+#else
+static char *mem_malloc_start; /* what malloc returned for the heap */
+#endif
+
+#if USE_MEM_MMAP
+/*
+ * mem_reserve - reserve mem_limit bytes of address space, aligned to a
+ *    huge page, without making any of it accessible
+ */
+static void mem_reserve(void)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    size_t align = MEM_HUGEPAGES ? MEM_HUGEPAGE_SIZE : mem_pagesize();
+    char *p = MAP_FAILED;
+
+#if MEM_HUGEPAGES == 2 && defined(MAP_HUGETLB)
+    /*
+     * Hugetlb mappings come back huge-page aligned.  Without
+     * MAP_NORESERVE the pool is charged now, so a short pool makes
+     * mmap fail here instead of faulting with SIGBUS later.
+     */
+    mem_map_size = (mem_limit + MEM_HUGEPAGE_SIZE - 1) & ~(size_t)(MEM_HUGEPAGE_SIZE - 1);
+    p = mmap(NULL, mem_map_size, PROT_NONE,
+	     (flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED)
+	fprintf(stderr, "mem_init: no huge pages, using base pages\n");
+    else
+	mem_start_brk = p;
+#endif
+    if (p == MAP_FAILED) {
+	mem_map_size = mem_limit + align;
+	p = mmap(NULL, mem_map_size, PROT_NONE, flags, -1, 0);
+	if (p == MAP_FAILED) {
+	    fprintf(stderr, "mem_init_vm: mmap error\n");
+	    exit(1);
+	}
+	mem_start_brk = (char *)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+#if MEM_HUGEPAGES && defined(MADV_HUGEPAGE)
+	madvise(mem_start_brk, mem_limit, MADV_HUGEPAGE);
+#endif
+    }
+    mem_map_start = p;
+    mem_commit_brk = mem_start_brk;
+}
+
+/*
+ * mem_commit - make the heap accessible up to at least end.  Several
+ *    threads may race to commit overlapping ranges; mprotect is
+ *    idempotent, so the loser just redoes part of the work.
+ */
+static int mem_commit(char *end)
+{
+    char *old = __atomic_load_n(&mem_commit_brk, __ATOMIC_ACQUIRE);
+    char *target;
+
+    if (end <= old)
+	return 0;
+    target = mem_start_brk +
+	(((size_t)(end - mem_start_brk) + MEM_COMMIT_GRAIN - 1) & ~(size_t)(MEM_COMMIT_GRAIN - 1));
+    if (target > mem_max_addr)
+	target = mem_max_addr;
+    if (mprotect(old, target - old, PROT_READ | PROT_WRITE) != 0)
+	return -1;
+    while (target > old &&
+	   !__atomic_compare_exchange_n(&mem_commit_brk, &old, target,
+					1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	;
+    return 0;
+}
+#endif
+
+/*
+ * mem_set_max_heap - set the largest heap, in bytes, that the next
+ *    mem_init will make room for (MAX_HEAP by default)
+ */
+void mem_set_max_heap(size_t size)
+{
+    mem_limit = size;
+}
+
+/*
+ * mem_max_heap - return the heap size limit in bytes
+ */
+size_t mem_max_heap(void)
+{
+    return mem_limit;
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+#if USE_MEM_MMAP
+    /* reserve the VM; pages are committed as the heap grows */
+    mem_reserve();
+    mem_fresh_brk = mem_start_brk;            /* new mappings read as zero */
+#else
+    /*
+     * allocate the storage we will use to model the available VM,
+     * page aligned like the reservation above
+     */
+    if ((mem_malloc_start = (char *)malloc(mem_limit + mem_pagesize())) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
+    mem_start_brk = (char *)(((uintptr_t)mem_malloc_start + mem_pagesize() - 1) &
+			     ~(uintptr_t)(mem_pagesize() - 1));
+    mem_fresh_brk = mem_start_brk + mem_limit; /* malloc'd memory is not zeroed */
+#endif
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    mem_max_addr = mem_start_brk + mem_limit; /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_peak = 0;
 }
 
 /* 
@@ -39,33 +180,171 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();            /* drops any mappings */
+#if USE_MEM_MMAP
+    munmap(mem_map_start, mem_map_size);
+#else
+    free(mem_malloc_start);
+#endif
 }
 
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ *    (committed pages stay committed for the next run)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    int i;
+
+    __atomic_store_n(&mem_brk, mem_start_brk, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&mem_maps_lock);
+    for (i = 0; i < mem_nmaps; i++)
+	munmap(mem_maps[i].lo, mem_maps[i].len);
+    mem_nmaps = 0;
+    __atomic_store_n(&mem_mapped, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mem_maps_lock);
+
+    __atomic_store_n(&mem_peak, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * mem_note_peak - fold the current footprint (heap plus mappings)
+ *    into the high-water mark
+ */
+static void mem_note_peak(void)
+{
+    size_t size = mem_heapsize() + __atomic_load_n(&mem_mapped, __ATOMIC_RELAXED);
+    size_t old = __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+
+    while (size > old &&
+	   !__atomic_compare_exchange_n(&mem_peak, &old, size,
+					1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+/*
+ * mem_release - tell the system that the whole pages inside
+ *    [addr, addr+len) are no longer needed.  The range stays mapped;
+ *    its contents become undefined (zero, with MADV_DONTNEED).
+ */
+void mem_release(void *addr, size_t len)
+{
+    uintptr_t mask = mem_pagesize() - 1;
+    uintptr_t lo = ((uintptr_t)addr + mask) & ~mask;
+    uintptr_t hi = ((uintptr_t)addr + len) & ~mask;
+
+    if (hi > lo)
+	madvise((void *)lo, hi - lo, MEM_RELEASE_ADVICE);
+}
+
+/*
+ * mem_move_brk - mem_sbrk_at, also setting *fresh (if fresh is not
+ *    NULL) to the first byte of a new area that has never been part
+ *    of the heap since mem_init.  The area reads as zero from there
+ *    on.
  */
-void *mem_sbrk(int incr) 
+static void *mem_move_brk(void *brk, intptr_t incr, void **fresh)
 {
-    char *old_brk = mem_brk;
+    char *old_brk = brk;
+    char *old_fresh;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if (incr < mem_start_brk - old_brk || incr > mem_max_addr - old_brk) {
 	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
-    return (void *)old_brk;
+#if USE_MEM_MMAP
+    if (incr > 0 && mem_commit(old_brk + incr) != 0) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+#endif
+    if (incr < 0)
+	mem_release(old_brk + incr, -incr);
+    if (!__atomic_compare_exchange_n(&mem_brk, &old_brk, old_brk + incr,
+				     0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+	errno = EAGAIN;
+	return (void *)-1;
+    }
+
+    if (incr > 0) {
+	/*
+	 * Whoever last had the pages below the fresh mark raised it
+	 * before using them, so whatever it says now is safe.
+	 */
+	old_fresh = __atomic_load_n(&mem_fresh_brk, __ATOMIC_ACQUIRE);
+	while (old_brk + incr > old_fresh &&
+	       !__atomic_compare_exchange_n(&mem_fresh_brk, &old_fresh, old_brk + incr,
+					    1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	    ;
+	if (fresh != NULL)
+	    *fresh = old_fresh > old_brk ? old_fresh : old_brk;
+	mem_note_peak();
+    }
+    return brk;
+}
+
+/*
+ * mem_sbrk_at - move the break by incr bytes, but only if it is still
+ *    at brk.  Returns brk, or (void *)-1 with errno set to EAGAIN if
+ *    another thread moved the break first, or ENOMEM if the new break
+ *    is out of range.
+ *
+ *    A negative incr shrinks the heap and releases the pages above the
+ *    new break.  They are released before the break moves so that no
+ *    other thread can have been handed them yet, which means the
+ *    caller loses the contents of [brk+incr, brk) even when the call
+ *    fails with EAGAIN.
+ */
+void *mem_sbrk_at(void *brk, intptr_t incr)
+{
+    return mem_move_brk(brk, incr, NULL);
+}
+
+/*
+ * mem_sbrk_fresh_at - mem_sbrk_at for a positive incr, setting *fresh
+ *    as mem_sbrk_fresh does
+ */
+void *mem_sbrk_fresh_at(void *brk, intptr_t incr, void **fresh)
+{
+    void *p = mem_move_brk(brk, incr, fresh);
+
+    if (p == (void *)-1 && errno == ENOMEM)
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+    return p;
+}
+
+/* 
+ * mem_sbrk - simple model of the sbrk function. Extends the heap 
+ *    by incr bytes and returns the start address of the new area.
+ *    The break is bumped with a compare-and-swap, so threads may call
+ *    this concurrently; each caller gets a disjoint area, not
+ *    necessarily adjacent to its last.  A negative incr shrinks the
+ *    heap (see mem_sbrk_at).
+ */
+void *mem_sbrk(intptr_t incr) 
+{
+    return mem_sbrk_fresh(incr, NULL);
+}
+
+/*
+ * mem_sbrk_fresh - mem_sbrk, also setting *fresh (if fresh is not
+ *    NULL) to the first byte of the new area that has never been part
+ *    of the heap since mem_init.  Everything from *fresh to the end of
+ *    the area is zero, so a calloc can skip clearing it.  Pages given
+ *    back by a negative incr don't count as fresh again.
+ */
+void *mem_sbrk_fresh(intptr_t incr, void **fresh)
+{
+    void *p;
+
+    do {
+	p = mem_move_brk(__atomic_load_n(&mem_brk, __ATOMIC_RELAXED), incr, fresh);
+    } while (p == (void *)-1 && errno == EAGAIN);
+
+    if (p == (void *)-1)
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+    return p;
 }
 
 /*
@@ -81,7 +360,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(__atomic_load_n(&mem_brk, __ATOMIC_ACQUIRE) - 1);
 }
 
 /*
@@ -89,7 +368,333 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return (size_t)(__atomic_load_n(&mem_brk, __ATOMIC_ACQUIRE) - mem_start_brk);
+}
+
+/*
+ * mem_mapsize() - returns the bytes in mem_map mappings
+ */
+size_t mem_mapsize()
+{
+    return __atomic_load_n(&mem_mapped, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_heapsize_peak() - returns the largest footprint, heap plus
+ *    mem_map mappings, since the last mem_reset_brk, in bytes
+ */
+size_t mem_heapsize_peak()
+{
+    return __atomic_load_n(&mem_peak, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * mem_find_map - index of the mapping that starts at p, or -1.
+ *    Caller holds mem_maps_lock.
+ */
+static int mem_find_map(void *p)
+{
+    int i;
+
+    for (i = 0; i < mem_nmaps; i++)
+	if (mem_maps[i].lo == p)
+	    return i;
+    return -1;
+}
+
+/*
+ * mem_map_add - record the mapping of len bytes at p
+ */
+static int mem_map_add(char *p, size_t len)
+{
+    mem_mapping_t *maps;
+
+    pthread_mutex_lock(&mem_maps_lock);
+    if (mem_nmaps == mem_maxmaps) {
+	maps = realloc(mem_maps, (mem_maxmaps ? 2 * mem_maxmaps : 16) * sizeof(*maps));
+	if (maps == NULL) {
+	    pthread_mutex_unlock(&mem_maps_lock);
+	    return -1;
+	}
+	mem_maps = maps;
+	mem_maxmaps = mem_maxmaps ? 2 * mem_maxmaps : 16;
+    }
+    mem_maps[mem_nmaps].lo = p;
+    mem_maps[mem_nmaps].len = len;
+    mem_nmaps++;
+    __atomic_fetch_add(&mem_mapped, len, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mem_maps_lock);
+
+    mem_note_peak();
+    return 0;
+}
+
+/*
+ * mem_map - give the caller a fresh, page-aligned mapping of len bytes
+ *    outside the heap, for blocks too big to carve from it.  Returns
+ *    (void *)-1 on failure.
+ */
+void *mem_map(size_t len)
+{
+    char *p;
+
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+	return (void *)-1;
+    if (mem_map_add(p, len) != 0) {
+	munmap(p, len);
+	return (void *)-1;
+    }
+    return p;
+}
+
+/*
+ * mem_unmap - return a mapping obtained from mem_map
+ */
+void mem_unmap(void *p)
+{
+    int i;
+
+    pthread_mutex_lock(&mem_maps_lock);
+    if ((i = mem_find_map(p)) < 0) {
+	pthread_mutex_unlock(&mem_maps_lock);
+	fprintf(stderr, "ERROR: mem_unmap of unknown mapping %p\n", p);
+	return;
+    }
+    munmap(p, mem_maps[i].len);
+    __atomic_fetch_sub(&mem_mapped, mem_maps[i].len, __ATOMIC_RELAXED);
+    mem_maps[i] = mem_maps[--mem_nmaps];
+    pthread_mutex_unlock(&mem_maps_lock);
+}
+
+/*
+ * mem_remap - resize a mapping obtained from mem_map to len bytes.
+ *    The kernel moves the pages rather than copying them, so the
+ *    mapping may change address.  Returns the new address, or
+ *    (void *)-1 (leaving the old mapping alone) on failure.
+ */
+void *mem_remap(void *p, size_t len)
+{
+    int i;
+    char *q;
+
+    pthread_mutex_lock(&mem_maps_lock);
+    if ((i = mem_find_map(p)) < 0) {
+	pthread_mutex_unlock(&mem_maps_lock);
+	fprintf(stderr, "ERROR: mem_remap of unknown mapping %p\n", p);
+	return (void *)-1;
+    }
+    q = mremap(p, mem_maps[i].len, len, MREMAP_MAYMOVE);
+    if (q == MAP_FAILED) {
+	pthread_mutex_unlock(&mem_maps_lock);
+	return (void *)-1;
+    }
+    __atomic_fetch_add(&mem_mapped, len - mem_maps[i].len, __ATOMIC_RELAXED);
+    mem_maps[i].lo = q;
+    mem_maps[i].len = len;
+    pthread_mutex_unlock(&mem_maps_lock);
+
+    mem_note_peak();
+    return q;
+}
+
+/*
+ * mem_mapped_range - return 1 iff [lo, hi] lies inside one mapping
+ *    obtained from mem_map
+ */
+int mem_mapped_range(void *lo, void *hi)
+{
+    int i, found = 0;
+
+    pthread_mutex_lock(&mem_maps_lock);
+    for (i = 0; i < mem_nmaps && !found; i++)
+	found = (char *)lo >= mem_maps[i].lo &&
+		(char *)hi < mem_maps[i].lo + mem_maps[i].len;
+    pthread_mutex_unlock(&mem_maps_lock);
+    return found;
+}
+
+/*
+ * mem_pages - round len up to whole pages
+ */
+static size_t mem_pages(size_t len)
+{
+    return (len + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+}
+
+/*
+ * mem_pwrite - write all len bytes at p to fd at off
+ */
+static int mem_pwrite(int fd, const void *p, size_t len, off_t off)
+{
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = pwrite(fd, p, len, off)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	p = (const char *)p + n;
+	len -= n;
+	off += n;
+    }
+    return 0;
+}
+
+#if USE_MEM_MMAP
+/*
+ * mem_pread - read all len bytes at off in fd into p; a short file is
+ *    an error (EINVAL)
+ */
+static int mem_pread(int fd, void *p, size_t len, off_t off)
+{
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = pread(fd, p, len, off)) <= 0) {
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    if (n == 0)
+		errno = EINVAL;
+	    return -1;
+	}
+	p = (char *)p + n;
+	len -= n;
+	off += n;
+    }
+    return 0;
+}
+#endif
+
+/*
+ * mem_save - write an image of the heap and of the mem_map mappings
+ *    to fd, starting at off (a multiple of the page size).  Nothing
+ *    may move the break or the mappings meanwhile.
+ */
+int mem_save(int fd, off_t off)
+{
+    size_t head = mem_pages(sizeof(mem_image_t) + mem_nmaps * sizeof(mem_mapping_t));
+    mem_image_t img;
+    char *page;
+    int i, rc = -1;
+
+    if ((page = calloc(1, head)) == NULL)
+	return -1;
+    img.magic = MEM_IMAGE_MAGIC;
+    img.base = mem_start_brk;
+    img.heap = mem_heapsize();
+    img.limit = mem_limit;
+    img.nmaps = mem_nmaps;
+    memcpy(page, &img, sizeof(img));
+    memcpy(page + sizeof(img), mem_maps, mem_nmaps * sizeof(mem_mapping_t));
+
+    if (mem_pwrite(fd, page, head, off) == 0 &&
+	mem_pwrite(fd, mem_start_brk, img.heap, off + head) == 0) {
+	off += head + mem_pages(img.heap);
+	for (i = 0; i < mem_nmaps; i++) {
+	    if (mem_pwrite(fd, mem_maps[i].lo, mem_maps[i].len, off) != 0)
+		break;
+	    off += mem_pages(mem_maps[i].len);
+	}
+	rc = (i == mem_nmaps) ? 0 : -1;
+    }
+    free(page);
+    return rc;
+}
+
+/*
+ * mem_load - replace the heap and all mappings with the image that
+ *    mem_save wrote to fd at off.  Everything goes back at the address
+ *    it was saved from.  The heap and the mappings are read into
+ *    anonymous memory, like mem_init's and mem_map's, rather than
+ *    mapped from the file: mem_remap may grow a mapping past the end
+ *    of the file, and mem_release can't drop the pages of a file
+ *    mapping (MADV_FREE fails on them).  Returns -1 if the image is
+ *    bad or its addresses are taken; the heap is then empty, as after
+ *    mem_init.
+ */
+int mem_load(int fd, off_t off)
+{
+#if USE_MEM_MMAP
+    int prot = PROT_READ | PROT_WRITE;
+    mem_mapping_t *maps = NULL;
+    mem_image_t img;
+    size_t head;
+    char *p;
+    int i;
+
+    if (pread(fd, &img, sizeof(img), off) != sizeof(img) ||
+	img.magic != MEM_IMAGE_MAGIC || img.heap > img.limit || img.nmaps < 0) {
+	errno = EINVAL;
+	return -1;
+    }
+    head = mem_pages(sizeof(img) + img.nmaps * sizeof(mem_mapping_t));
+    if ((maps = malloc(img.nmaps * sizeof(mem_mapping_t) + 1)) == NULL)
+	return -1;
+    if (pread(fd, maps, img.nmaps * sizeof(mem_mapping_t), off + sizeof(img)) !=
+	(ssize_t)(img.nmaps * sizeof(mem_mapping_t))) {
+	free(maps);
+	errno = EINVAL;
+	return -1;
+    }
+
+    /* drop the current heap and reserve the image's address range */
+    mem_deinit();
+    p = mmap(img.base, img.limit, PROT_NONE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != img.base) {
+	if (p != MAP_FAILED)
+	    munmap(p, img.limit);
+	mem_init();
+	free(maps);
+	errno = EADDRINUSE;
+	return -1;
+    }
+    mem_limit = img.limit;
+    mem_map_start = mem_start_brk = p;
+    mem_map_size = img.limit;
+    mem_max_addr = p + img.limit;
+    mem_brk = mem_fresh_brk = p + img.heap;   /* still zero past it */
+    mem_commit_brk = p + mem_pages(img.heap);
+    if (img.heap > 0 &&
+	(mprotect(p, mem_pages(img.heap), prot) != 0 ||
+	 mem_pread(fd, p, img.heap, off + head) != 0))
+	goto fail;
+
+    off += head + mem_pages(img.heap);
+    for (i = 0; i < img.nmaps; i++) {
+	p = mmap(maps[i].lo, maps[i].len, prot,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (p != maps[i].lo) {
+	    if (p != MAP_FAILED)
+		munmap(p, maps[i].len);
+	    errno = EADDRINUSE;
+	    goto fail;
+	}
+	if (mem_pread(fd, p, maps[i].len, off) != 0 ||
+	    mem_map_add(p, maps[i].len) != 0) {
+	    munmap(p, maps[i].len);
+	    goto fail;
+	}
+	off += mem_pages(maps[i].len);
+    }
+    free(maps);
+    mem_peak = 0;
+    mem_note_peak();
+    return 0;
+
+ fail:
+    i = errno;
+    mem_deinit();
+    mem_init();
+    free(maps);
+    errno = i;
+    return -1;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
 }
 
 /*
@@ -1,11 +1,26 @@
 #include <unistd.h>
+#include <stdint.h>
 
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void mem_set_max_heap(size_t size);
+size_t mem_max_heap(void);
+void *mem_sbrk(intptr_t incr);
+void *mem_sbrk_fresh(intptr_t incr, void **fresh);
+void *mem_sbrk_at(void *brk, intptr_t incr);
+void *mem_sbrk_fresh_at(void *brk, intptr_t incr, void **fresh);
+void mem_release(void *addr, size_t len);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_heapsize_peak(void);
+size_t mem_mapsize(void);
 size_t mem_pagesize(void);
+void *mem_map(size_t len);
+void mem_unmap(void *p);
+void *mem_remap(void *p, size_t len);
+int mem_mapped_range(void *lo, void *hi);
+int mem_save(int fd, off_t off);
+int mem_load(int fd, off_t off);
 
@@ -1,17 +1,25 @@
 
 /* 
- * mm-implicit.c -  Simple allocator based on implicit free lists, 
- *                  first fit placement, and boundary tag coalescing. 
+ * mm.c - Boundary-tag allocator with segregated free lists (exact
+ *        size bins and a best-fit treap by default), per-thread
+ *        arenas and caches, slab runs for small requests and a
+ *        mapping of its own for each huge one.
  *
- * Each block has header and footer of the form:
+ * Each block has a header of the form:
  * 
  *      31                     3  2  1  0 
  *      -----------------------------------
- *     | s  s  s  s  ... s  s  s  0  0  a/f
+ *     | s  s  s  s  ... s  s  s  m pa a/f
  *      ----------------------------------- 
  * 
- * where s are the meaningful size bits and a/f is set 
- * iff the block is allocated. The list has the following form:
+ * where s are the meaningful size bits, a/f is set iff the block
+ * is allocated, pa is set iff the previous block is allocated and
+ * m is set iff the block is a mapping of its own (see below).
+ * Free blocks repeat the header in a footer so that a successor can
+ * find them while coalescing; allocated blocks have no footer
+ * (CS:APP 9.9 practice extension), which saves a word per live
+ * block.  Building with -DELIDE_FOOTERS=0 keeps footers on
+ * allocated blocks as well. The list has the following form:
  *
  * begin                                                          end
  * heap                                                           heap  
@@ -23,13 +31,124 @@
  *
  * The allocated prologue and epilogue blocks are overhead that
  * eliminate edge conditions during coalescing.
+ *
+ * Free blocks are additionally kept on explicit free lists.  A free
+ * block stores the heap offsets of its successor and predecessor in
+ * the first two words of its payload:
+ *
+ *      -----------------------------------------------------
+ *     | hdr(s:f) | next offset | prev offset | ... | ftr(s:f) |
+ *      -----------------------------------------------------
+ *
+ * Tags and offsets are 32-bit words, which keeps small blocks small
+ * but caps the heap at 4 GB.  Building with -DWIDE_HEADERS=1 makes
+ * them 64 bits wide (and the alignment 16 bytes) for larger heaps,
+ * whose size memlib takes at run time (mem_set_max_heap).
+ *
+ * By default (FIT_TREE) blocks of up to TREE_MIN bytes sit in one bin
+ * per exact size, with a bitmap of non-empty bins, and larger blocks
+ * in a treap keyed on size whose links follow the list links.  Both
+ * halves hand find_fit the best fit: the bitmap in constant time, the
+ * treap in O(log n).
+ *
+ * -DFIT_POLICY=FIT_SEGLIST uses 20 segregated lists instead, where
+ * size class i holds blocks of 2^(i+4) up to 2^(i+5)-1 bytes and is
+ * searched first fit.  Building with -DFIT_POLICY=FIT_NEXT restores
+ * the original implicit-list next-fit scan for comparison.
+ *
+ * -DFIT_POLICY=FIT_TLSF uses the same links but indexes the lists
+ * two-level segregated fit style: a first level per power of two,
+ * split into SL_COUNT linear second-level ranges, with a bitmap of
+ * non-empty lists at each level.  The request is rounded up to the
+ * next second-level range so that the head of any list found by
+ * the bitmap search is guaranteed to fit, which makes malloc and
+ * free constant time apart from extend_heap.
+ *
+ * Requests of SLAB_MAX bytes or less bypass the boundary-tag heap
+ * and come from slab runs: SLAB_RUN_SIZE-byte allocated blocks,
+ * aligned to their own size, that are carved into equal objects of
+ * one size class.  Objects have no header; a bitmap in the run
+ * header tracks which are free, and the page map (one byte per
+ * PAGE_GRAIN of heap) tells mm_free whether a pointer belongs to a
+ * run.  -DUSE_SLABS=0 turns the slab path off.
+ *
+ * The allocator is thread safe.  All of the state above lives in an
+ * arena_t; MM_ARENAS arenas, each behind its own mutex, are handed
+ * out round-robin to threads on their first call.  An arena grows
+ * in chunks taken from the break with an atomic compare-and-swap.
+ * When an arena's new chunk is adjacent to its previous one, the old
+ * epilogue becomes the new block's header as in the single-heap
+ * allocator; otherwise the chunk starts on a fresh page with its own
+ * prologue and epilogue.  The page map records which arena owns each
+ * page, so a block can be freed from any thread.
+ *
+ * Requests of MMAP_THRESHOLD bytes or more never touch the heap.
+ * Each gets a mapping of its own from mem_map, which starts with the
+ * mapping length as a size_t and ends its first MAP_PAD bytes with
+ * a header whose m bit is set.  mm_free unmaps it, and mm_realloc
+ * resizes it with mem_remap, which moves pages instead of copying
+ * bytes.
+ *
+ * In front of the arenas, every thread keeps a small cache (tcache)
+ * of recently freed slab objects and small blocks binned by exact
+ * size.  Cached blocks stay allocated as far as the heap is
+ * concerned, so mm_malloc and mm_free can hit the cache without
+ * taking a lock.  That costs utilization, so the caches hold at most
+ * TCACHE_BYTES each and stay off until a second thread allocates.
+ * -DMM_THREADS=0 builds the single-threaded allocator without locks
+ * or caches.
+ *
+ * mm_malloc_batch and mm_free_batch serve groups of blocks with one
+ * lock each: a batch of equal blocks is carved back to back from one
+ * free block, and a batch free sorts its blocks so that neighbours
+ * are merged before they are coalesced with the rest of the heap.
+ *
+ * Building with -DDEFER_COALESCE=1 defers the coalescing of small
+ * frees, dlmalloc fastbin style: blocks of up to QUICK_MAX bytes wait
+ * on per-size quick lists, still tagged allocated, for a malloc of
+ * their exact size.  When a fit search fails, the quick lists are
+ * swept in address order and coalesced before the heap may grow, so
+ * they never cost the heap more than it already had.
+ *
+ * mm_realloc watches for blocks that keep growing.  Once a block has
+ * grown GROW_CHAIN times in a row, a realloc that has to move it
+ * takes half as much again as asked, and one that absorbs a free
+ * successor keeps that much of it, so that the next growths happen
+ * in place and the bytes copied stay linear in the final size.  A
+ * realloc that does not grow ends the chain and trims the block back
+ * to the request, and so does leaving the block alone for a while;
+ * blocks that never grow get no headroom at all.  -DGROW_HEADROOM=0
+ * turns this off.
+ *
+ * mm_snapshot writes the heap to a file and mm_restore reads it back,
+ * in this or a later run of the same program, at the address it was
+ * taken from.  Links inside the heap are offsets and the arenas only
+ * point into the heap, so nothing needs rewriting; see mm_snapshot.
+ *
+ * mm_check_step checks the heap a few blocks at a time, for use in
+ * production where mm_checkheap's full walk is too slow.  Each arena
+ * keeps a cursor into its chunks, which the chunks' pad words link
+ * together, and every call checks the next window of some arena.
+ * Building with -DCHECK_EVERY=n (or calling mm_check_every) makes
+ * every n-th malloc, free or realloc of a thread take one step.
+ *
+ * The remaining knobs are plain parameters: CHUNKSIZE, the least the
+ * heap grows by; SPLIT_MIN, the smallest rest worth splitting off a
+ * block; and LIST_ORDER, LIFO or address-ordered free lists.  Like
+ * the ones above they are compile-time, so each combination builds
+ * its own hot path; "make bench-matrix" builds a set of them as
+ * mdriver backends and compares them on the default traces.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <memory.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/mman.h>
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -56,37 +175,270 @@ team_t team = {
 // make debugging code easier.
 //
 /////////////////////////////////////////////////////////////////////////////
-#define WSIZE       4       /* word size (bytes) */  
-#define DSIZE       8       /* doubleword size (bytes) */
-#define CHUNKSIZE  (1<<12)  /* initial heap size (bytes) */
-#define OVERHEAD    8       /* overhead of header and footer (bytes) */
+//
+// A word holds one boundary tag or free list link (see WIDE_HEADERS
+// at the top of the file)
+//
+#ifndef WIDE_HEADERS
+#define WIDE_HEADERS 0
+#endif
+
+#if WIDE_HEADERS
+typedef uint64_t word_t;
+#else
+typedef uint32_t word_t;
+#endif
+
+#define WSIZE       ((int)sizeof(word_t))  /* word size (bytes) */
+#define DSIZE       (2*WSIZE)              /* doubleword size (bytes) */
+#ifndef CHUNKSIZE
+#define CHUNKSIZE  (1<<12)  /* initial heap size and least extension (bytes) */
+#endif
+#define OVERHEAD    DSIZE   /* overhead of header and footer (bytes) */
+#define SIZE_BITS   (8*WSIZE)              /* bits in a header word */
+
+#ifndef ELIDE_FOOTERS
+#define ELIDE_FOOTERS 1     /* allocated blocks carry only a header */
+#endif
+
+#if ELIDE_FOOTERS
+#define ALLOC_OVERHEAD WSIZE     /* overhead of an allocated block */
+#else
+#define ALLOC_OVERHEAD OVERHEAD
+#endif
+
+//
+// Fit engine selection
+//
+#define FIT_NEXT     0      /* implicit list, next-fit from the rover */
+#define FIT_SEGLIST  1      /* segregated explicit free lists */
+#define FIT_TLSF     2      /* two-level bitmap indexed free lists */
+#define FIT_TREE     3      /* exact small bins, best-fit treap above */
+
+#ifndef FIT_POLICY
+#define FIT_POLICY  FIT_TREE
+#endif
+
+//
+// Order of the blocks on a free list (the exact bins of FIT_TREE,
+// the classes of FIT_SEGLIST and FIT_TLSF)
+//
+#define LIST_LIFO    0      /* freed blocks go to the head */
+#define LIST_ADDR    1      /* blocks are kept in address order */
+
+#ifndef LIST_ORDER
+#define LIST_ORDER  LIST_LIFO
+#endif
+
+#if FIT_POLICY == FIT_TLSF
+#define SL_LOG2     3                   /* log2 of second-level lists */
+#define SL_COUNT    (1 << SL_LOG2)
+#define FL_SHIFT    (SL_LOG2 + 3)       /* sizes below 2^FL_SHIFT are fl 0 */
+#define FL_COUNT    (SIZE_BITS - FL_SHIFT + 1)
+#define NUM_CLASSES (FL_COUNT * SL_COUNT)
+#elif FIT_POLICY == FIT_TREE
+#define TREE_MIN    512                 /* larger free blocks live in the treap */
+#define NUM_CLASSES (TREE_MIN / DSIZE - 1)  /* one bin per size, 16..TREE_MIN */
+#else
+#define NUM_CLASSES 20      /* number of segregated size classes */
+#endif
+
+//
+// Slab pools for small requests
+//
+#ifndef USE_SLABS
+#define USE_SLABS   1
+#endif
+
+#define SLAB_MAX        64                          /* largest slab request */
+#define SLAB_CLASSES    (SLAB_MAX / DSIZE)          /* one class per doubleword */
+#define SLAB_RUN_SIZE   (1<<12)                     /* bytes per run */
+#define SLAB_MAP_WORDS  (SLAB_RUN_SIZE / DSIZE / 64)  /* freemap words per run */
+
+//
+// Deferred coalescing.  With -DDEFER_COALESCE=1, freed blocks of up
+// to QUICK_MAX bytes go onto a quick list of their exact size without
+// being coalesced, and keep their allocated tags meanwhile; a malloc
+// of that size takes one back without a split.
+//
+#ifndef DEFER_COALESCE
+#define DEFER_COALESCE  0
+#endif
+
+#define QUICK_MAX       512                         /* largest quick block */
+#define QUICK_BINS      (QUICK_MAX / DSIZE + 1)     /* one list per size */
+
+//
+// Arenas and thread caches
+//
+#ifndef MM_THREADS
+#define MM_THREADS  1
+#endif
+
+#if MM_THREADS && FIT_POLICY != FIT_NEXT
+#define MM_ARENAS   8       /* independently locked arenas */
+#else
+#define MM_ARENAS   1       /* the next-fit rover needs one contiguous heap */
+#endif
+
+#define TCACHE_MAX    512   /* largest block size kept in a thread cache */
+#define TCACHE_BYTES  (16<<10)  /* most bytes a thread cache holds */
+#define TCACHE_BINS   (SLAB_CLASSES + TCACHE_MAX / DSIZE + 1)
+
+//
+// Thread caches and quick lists link blocks through their payload, so
+// only blocks of LINK_MIN bytes or more can go on them; the smallest
+// next-fit blocks are too short
+//
+#define LINK_MIN      (WSIZE + (int)sizeof(void *))
+
+//
+// Every page of the heap belongs to exactly one arena: an arena grows
+// by what it needs, but a chunk that does not continue its own last
+// one starts on a fresh page, leaving the rest of the page it would
+// have shared unused.  The page map holds the owner of each page,
+// plus PAGE_SLAB for pages that are slab runs.
+//
+#define PAGE_GRAIN      SLAB_RUN_SIZE
+#define PAGE_SLAB       0x80
+#define PAGE_ARENA      0x7f
+#define CHUNK_OVERHEAD  (4*WSIZE)   /* pad, prologue and epilogue of a chunk */
+#define PAGE_ROUND(p)   ((char *)(((uintptr_t)(p) + PAGE_GRAIN - 1) & ~(uintptr_t)(PAGE_GRAIN - 1)))
+
+//
+// Giving memory back.  When a free leaves a block of TRIM_THRESHOLD
+// bytes or more at the end of the heap, the heap is cut back with a
+// negative mem_sbrk so that TRIM_PAD bytes stay free.  Interior free
+// blocks of RELEASE_THRESHOLD bytes or more keep their tags but have
+// the whole pages between them released, provided the free added at
+// least RELEASE_MIN bytes that were not released already.  All three
+// are large so that steady-state malloc/free traffic rarely makes a
+// syscall, and an arena that has to grow again right after a trim
+// doubles its trim threshold (up to TRIM_MAX), much like glibc's
+// dynamic mmap threshold.
+//
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD    (1<<20)
+#endif
+#ifndef RELEASE_THRESHOLD
+#define RELEASE_THRESHOLD (1<<24)
+#endif
+#ifndef RELEASE_MIN
+#define RELEASE_MIN       (1<<22)
+#endif
+#define TRIM_PAD          CHUNKSIZE
+#define TRIM_MAX          (1<<26)
+
+//
+// Huge requests bypass the arenas and get their own mapping
+//
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD    (1<<17)
+#endif
+#define MAPPED            0x4       /* header bit of a mapped block */
+#define MAP_PAD           16        /* mapping length and header */
+
+//
+// mm_malloc_batch carves at most BATCH_RUN bytes of blocks out of
+// one free block
+//
+#define BATCH_RUN         (1<<20)
+
+//
+// Realloc growth chains.  Each arena remembers the last blocks that
+// mm_realloc grew in GROW_SLOTS slots, hashed by block offset.  A
+// block that has grown GROW_CHAIN times in a row gets GROW_DIV-th of
+// its size again as headroom, until it goes GROW_AGE of the arena's
+// mallocs and reallocs without growing.
+//
+#ifndef GROW_HEADROOM
+#define GROW_HEADROOM     1
+#endif
+#define GROW_LOG2         6
+#define GROW_SLOTS        (1 << GROW_LOG2)
+#define GROW_CHAIN        2
+#define GROW_DIV          2
+#define GROW_AGE          1024
+
+//
+// Incremental checking: every CHECK_EVERY requests of a thread (0 for
+// never), mm_check_step looks at CHECK_BLOCKS blocks of one arena
+//
+#ifndef CHECK_EVERY
+#define CHECK_EVERY       0
+#endif
+#ifndef CHECK_BLOCKS
+#define CHECK_BLOCKS      64
+#endif
+
+//
+// A free block must hold its boundary tags, plus both list links
+// for the explicit-list engines.  With footer elision, the implicit
+// engine gets by with a single doubleword.
+//
+#if FIT_POLICY == FIT_NEXT && ELIDE_FOOTERS
+#define MIN_BLOCK   DSIZE
+#else
+#define MIN_BLOCK   (2*DSIZE)
+#endif
 
-static inline int MAX(int x, int y) {
+//
+// A block is only split when the rest would make a free block of at
+// least SPLIT_MIN bytes; a smaller rest stays with the allocated
+// block.  Raising it trades internal fragmentation for fewer, larger
+// free blocks.
+//
+#ifndef SPLIT_MIN
+#define SPLIT_MIN   MIN_BLOCK
+#endif
+_Static_assert(SPLIT_MIN >= MIN_BLOCK, "SPLIT_MIN is below MIN_BLOCK");
+
+static inline size_t MAX(size_t x, size_t y) {
   return x > y ? x : y;
 }
 
+static inline size_t MIN(size_t x, size_t y) {
+  return x < y ? x : y;
+}
+
+//
+// Index of the most significant set bit of x, which must not be 0
+//
+static inline int LOG2(size_t x) {
+  return 63 - __builtin_clzll(x);
+}
+
+//
+// Adjust a request size to include overhead and alignment reqs.
+//
+static inline size_t adjust_size(size_t size) {
+  if (size + ALLOC_OVERHEAD <= MIN_BLOCK)
+    return MIN_BLOCK;
+  return DSIZE * ((size + (ALLOC_OVERHEAD) + (DSIZE-1)) / DSIZE);
+}
+
 //
-// Pack a size and allocated bit into a word
-// We mask of the "alloc" field to insure only
-// the lower bit is used
+// Pack a size, previous-allocated bit and allocated bit into a word
+// We mask of the "alloc" fields to insure only
+// the lower bits are used
 //
-static inline uint32_t PACK(uint32_t size, int alloc) {
-  return ((size) | (alloc & 0x1));
+static inline word_t PACK(size_t size, int prev_alloc, int alloc) {
+  return ((size) | ((prev_alloc & 0x1) << 1) | (alloc & 0x1));
 }
 
 //
 // Read and write a word at address p
 //
-static inline uint32_t GET(void *p) { return  *(uint32_t *)p; }
-static inline void PUT( void *p, uint32_t val)
+static inline word_t GET(void *p) { return  *(word_t *)p; }
+static inline void PUT( void *p, word_t val)
 {
-  *((uint32_t *)p) = val;
+  *((word_t *)p) = val;
 }
 
 //
 // Read the size and allocated fields from address p
 //
-static inline uint32_t GET_SIZE( void *p )  { 
+static inline word_t GET_SIZE( void *p )  { 
   return GET(p) & ~0x7;
 }
 
@@ -94,6 +446,14 @@ static inline int GET_ALLOC( void *p  ) {
   return GET(p) & 0x1;
 }
 
+static inline int GET_PREV_ALLOC( void *p ) {
+  return (GET(p) >> 1) & 0x1;
+}
+
+static inline int GET_MAPPED( void *p ) {
+  return (GET(p) >> 2) & 0x1;
+}
+
 //
 // Given block ptr bp, compute address of its header and footer
 //
@@ -112,285 +472,2880 @@ static inline void *NEXT_BLKP(void *bp) {
   return  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)));
 }
 
+//
+// PREV_BLKP reads the previous block's footer, so it is only valid
+// when GET_PREV_ALLOC(HDRP(bp)) says that block is free.
+//
 static inline void* PREV_BLKP(void *bp){
   return  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)));
 }
 
+//
+// Write the boundary tags of block bp.  Free blocks always get a
+// footer; allocated blocks only when footers are not elided.
+//
+static inline void PUT_TAGS(void *bp, size_t size, int prev_alloc, int alloc) {
+  PUT(HDRP(bp), PACK(size, prev_alloc, alloc));
+  if (!ELIDE_FOOTERS || !alloc)
+    PUT(FTRP(bp), PACK(size, prev_alloc, alloc));
+}
+
+//
+// Record in block bp's header whether its predecessor is allocated.
+// bp may be allocated and being freed by another thread, which reads
+// its size without the arena lock (see tcache_block_bin), so the
+// header is rewritten with a single atomic store.
+//
+static inline void SET_PREV_ALLOC(void *bp, int prev_alloc) {
+  word_t *hp = (word_t *)HDRP(bp);
+
+  __atomic_store_n(hp, (*hp & ~0x2) | ((prev_alloc & 0x1) << 1), __ATOMIC_RELAXED);
+}
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // Global Variables
 //
 
-static char *heap_listp;  /* pointer to first block */  
-static char* temp;
+static char *heap_base;   /* first byte of the heap; free links are relative */
+static size_t heap_span;             /* bytes memlib reserved for the heap */
+static uint8_t *page_map;            /* owner arena and PAGE_SLAB per page */
+static uint32_t page_hi;             /* pages marked since mm_init */
+static uint32_t mm_gen;              /* bumped by mm_init to drop stale tcaches */
+static uint64_t map_reallocs[2];     /* mapped reallocs: kept the pointer, moved */
+static unsigned check_every = CHECK_EVERY;   /* requests per mm_check_step */
+static unsigned check_blocks = CHECK_BLOCKS; /* blocks per mm_check_step */
+static uint32_t check_arena;         /* arena the next step checks */
+static __thread unsigned check_ops;  /* requests since this thread's last step */
 
+#if USE_SLABS
 //
-// function prototypes for internal helper routines
+// Every slab run starts with this header; its objects follow at
+// SLAB_HDR_SIZE.  Runs with at least one free object are kept on a
+// doubly linked list per class, linked by heap offsets.
 //
-static void *extend_heap(uint32_t words);
-static void place(void *bp, uint32_t asize);
-static void *find_fit(uint32_t asize);
-static void *coalesce(void *bp);
-static void printblock(void *bp); 
-static void checkblock(void *bp);
+typedef struct {
+  word_t next;                      /* next partial run of this class */
+  word_t prev;                      /* previous partial run */
+  uint16_t objsize;                   /* object size (bytes) */
+  uint16_t nobjs;                     /* objects in this run */
+  uint16_t nfree;                     /* free objects in this run */
+  uint16_t hint;                      /* lowest freemap word with a set bit */
+  uint64_t freemap[SLAB_MAP_WORDS];   /* bit i set iff object i is free */
+} slab_run_t;
+
+#define SLAB_HDR_SIZE   ((sizeof(slab_run_t) + DSIZE - 1) & ~(DSIZE - 1))
+
+#endif
 
 //
-// mm_init - Initialize the memory manager 
+// A block mm_realloc has grown.  The entry only counts while the
+// block at off still has the size the entry recorded; anything else
+// means the block was freed or resized behind its back.
 //
-int mm_init(void) {
-  if((heap_listp = mem_sbrk(4 * WSIZE)) == (void *) - 1)
-    return -1;
-  PUT(heap_listp, 0); 
-  PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1)); 
-  PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1)); 
-  PUT(heap_listp + (3 * WSIZE), PACK(0, 1)); 
-  heap_listp += (2 * WSIZE);
+typedef struct {
+  word_t off;                         /* heap offset of the block, 0 if unused */
+  word_t size;                        /* block size after the last growth */
+  word_t want;                        /* block size that growth asked for */
+  uint32_t grows;                     /* growths in a row */
+  uint32_t stamp;                     /* arena's grow_clock at the last growth */
+} grow_t;
 
-  temp = heap_listp; 
+//
+// Everything an arena needs to manage its part of the heap
+//
+typedef struct {
+  pthread_mutex_t lock;
+  int id;                             /* index in arenas[] and the page map */
+  char *heap_listp;                   /* prologue of the first chunk */
+  char *temp;                         /* next-fit rover */
+  char *brk;                          /* end of the most recent chunk */
+  char *last_chunk;                   /* start of the most recent chunk */
+  char *check_chunk;                  /* chunk mm_check_step is in... */
+  char *check_cursor;                 /* ... and the next block it checks */
+  size_t trim_threshold;            /* current tail trim threshold */
+  int trimmed;                        /* heap trimmed since the last extend */
+  void *fresh;                        /* last chunk is untouched from here up */
+  word_t free_lists[NUM_CLASSES];   /* list heads, as heap offsets */
+#if FIT_POLICY == FIT_TLSF
+  word_t fl_bitmap;                 /* bit f set iff some list in fl f is non-empty */
+  uint32_t sl_bitmap[FL_COUNT];       /* bit s set iff list (f, s) is non-empty */
+#elif FIT_POLICY == FIT_TREE
+  uint64_t bin_map;                   /* bit c set iff bin c is non-empty */
+  word_t tree_root;                 /* treap of blocks above TREE_MIN */
+  uint32_t tree_seed;                 /* xorshift state for treap priorities */
+#endif
+#if USE_SLABS
+  word_t slab_partial[SLAB_CLASSES];  /* partial runs per class */
+#endif
+#if DEFER_COALESCE
+  void *quick[QUICK_BINS];            /* uncoalesced blocks by exact size */
+  uint32_t nquick;                    /* blocks on the quick lists */
+#endif
+  grow_t grow[GROW_SLOTS];            /* recently grown blocks */
+  uint32_t grow_clock;                /* mallocs and reallocs, for aging them */
+  size_t block_bytes;                 /* bytes of the arena's chunks in blocks */
+  struct mm_stats st;                 /* counters mm_stats sums; see there */
+} arena_t;
 
-  if(extend_heap(CHUNKSIZE / WSIZE) == NULL)
-    return -1;
-  return 0;
-  return 0;
-}
+//
+// STAT_SET/ADD/SUB - Update a counter mm_stats reads.  Only the
+// arena's lock holder writes it, but mm_stats reads it with STAT_GET
+// and no lock, so the store is atomic: a reader sees the old value or
+// the new one.
+//
+#define STAT_GET(var)     __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define STAT_SET(var, v)  __atomic_store_n(&(var), (v), __ATOMIC_RELAXED)
+#define STAT_ADD(var, n)  STAT_SET(var, (var) + (n))
+#define STAT_SUB(var, n)  STAT_SET(var, (var) - (n))
 
+static arena_t arenas[MM_ARENAS];
 
+#if MM_THREADS
 //
-// extend_heap - Extend heap with free block and return its block pointer
+// Per-thread cache of freed blocks.  Bins 0..SLAB_CLASSES-1 hold slab
+// objects by class, the rest boundary-tag blocks by exact size.  The
+// first word of a cached block links to the next one in its bin.
 //
-static void *extend_heap(uint32_t words) 
-{
-    char *bp;
-    uint32_t size;
+typedef struct {
+  uint32_t gen;                       /* mm_gen this cache was filled under */
+  int registered;                     /* exit destructor installed */
+  size_t bytes;                       /* in all bins */
+  void *head[TCACHE_BINS];
+} tcache_t;
 
-    size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-    if((long)(bp = mem_sbrk(size)) == -1){ return NULL; }
+static __thread tcache_t tcache;
+static __thread arena_t *thread_arena;
+static uint32_t next_arena;
+static int tcache_on;                /* set once a second thread allocates */
+static pthread_key_t tcache_key;
+static pthread_once_t mm_once = PTHREAD_ONCE_INIT;
+#endif
 
-    PUT(HDRP(bp), PACK(size, 0)); 
-    PUT(FTRP(bp), PACK(size, 0)); 
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); 
+//
+// Free list links are stored as offsets from heap_base so they fit
+// in a word and keep the minimum block at 2*DSIZE.
+// Offset 0 is the alignment pad, which is never a block, so it
+// doubles as the null link.
+//
+static inline void *OFF2PTR(word_t off) {
+  return off ? heap_base + off : NULL;
+}
+static inline word_t PTR2OFF(void *bp) {
+  return bp ? (word_t)((char *)bp - heap_base) : 0;
+}
+
+//
+// Given free block ptr bp, compute address of its next and prev links
+//
+static inline void *NEXT_FREEP(void *bp) { return bp; }
+static inline void *PREV_FREEP(void *bp) { return (char *)bp + WSIZE; }
+
+static inline void *NEXT_FREE(void *bp) { return OFF2PTR(GET(NEXT_FREEP(bp))); }
+static inline void *PREV_FREE(void *bp) { return OFF2PTR(GET(PREV_FREEP(bp))); }
 
-    return coalesce(bp);
+//
+// size_class - map a block size to its segregated list index
+//
+#if FIT_POLICY == FIT_TLSF
+static inline void tlsf_mapping(size_t size, int *fl, int *sl) {
+  if (size < (1 << FL_SHIFT)) {
+    *fl = 0;
+    *sl = size >> (FL_SHIFT - SL_LOG2);
+  }
+  else {
+    int f = LOG2(size);
+    *sl = (size >> (f - SL_LOG2)) ^ SL_COUNT;
+    *fl = f - FL_SHIFT + 1;
+  }
 }
 
+static inline int size_class(size_t size) {
+  int fl, sl;
+  tlsf_mapping(size, &fl, &sl);
+  return fl * SL_COUNT + sl;
+}
+#elif FIT_POLICY == FIT_TREE
+static inline int size_class(size_t size) {
+  return size / DSIZE - 2;              /* only for sizes up to TREE_MIN */
+}
+#else
+static inline int size_class(size_t size) {
+  int c = LOG2(size) - 4;
+  return c < NUM_CLASSES ? c : NUM_CLASSES - 1;
+}
+#endif
 
+#if FIT_POLICY == FIT_TREE
 //
-// Practice problem 9.8
+// Free blocks above TREE_MIN form a treap: a binary search tree on
+// size that is also a max-heap on a random priority drawn when the
+// block enters the tree, which keeps it balanced in expectation.
+// Blocks whose size is already in the tree go on a list hanging off
+// that node through their next/prev links; a node's own prev link
+// is always zero.
 //
-// find_fit - Find a fit for a block with asize bytes 
+//  ------------------------------------------------------------------
+// | hdr | next | prev | left | right | parent | prio | ... | ftr |
+//  ------------------------------------------------------------------
 //
-static void *find_fit(uint32_t asize)
-{ 
-    char *oldtemp = temp;
+static inline void *LEFTP(void *bp)   { return (char *)bp + (2 * WSIZE); }
+static inline void *RIGHTP(void *bp)  { return (char *)bp + (3 * WSIZE); }
+static inline void *PARENTP(void *bp) { return (char *)bp + (4 * WSIZE); }
+static inline void *PRIOP(void *bp)   { return (char *)bp + (5 * WSIZE); }
 
-    for( ; GET_SIZE(HDRP(temp)) > 0; temp = NEXT_BLKP(temp)){
-      if(!GET_ALLOC(HDRP(temp)) && (asize <= GET_SIZE(HDRP(temp)))){ return temp; }
-    }
+static inline void *LEFT(void *bp)   { return OFF2PTR(GET(LEFTP(bp))); }
+static inline void *RIGHT(void *bp)  { return OFF2PTR(GET(RIGHTP(bp))); }
+static inline void *PARENT(void *bp) { return OFF2PTR(GET(PARENTP(bp))); }
+#endif
 
-    for(temp = heap_listp; temp < oldtemp; temp = NEXT_BLKP(temp)){
-        if(!GET_ALLOC(HDRP(temp)) && (asize <= GET_SIZE(HDRP(temp)))) { return temp; }
-    }
+//
+// function prototypes for internal helper routines
+//
+static void *extend_heap(arena_t *a, size_t words);
+static void place(arena_t *a, void *bp, size_t asize);
+static void place_run(arena_t *a, void *bp, size_t asize, size_t k, void **ptrs);
+static void shrink_block(arena_t *a, void *bp, size_t asize);
+static inline void grow_age(arena_t *a);
+static inline void grow_forget(arena_t *a, void *bp);
+static inline int grow_listed(arena_t *a, void *bp);
+static void *find_fit(arena_t *a, size_t asize);
+static void *place_aligned(arena_t *a, void *bp, size_t asize, size_t align);
+static void *alloc_aligned(arena_t *a, size_t asize, size_t align);
+static void *coalesce(arena_t *a, void *bp);
+static void insert_free(arena_t *a, void *bp);
+static void remove_free(arena_t *a, void *bp);
+#if FIT_POLICY == FIT_TREE
+static void tree_insert(arena_t *a, void *bp);
+static void tree_remove(arena_t *a, void *bp);
+static void *tree_best_fit(arena_t *a, size_t asize);
+#endif
+static void *arena_malloc(arena_t *a, size_t size, int *fresh);
+static void arena_free(arena_t *a, void *bp);
+static void *malloc_block(size_t size);
+static void free_block(void *bp);
+static void free_span(arena_t *a, void *bp, size_t size);
+static size_t largest_free(arena_t *a);
+static void unlink_free(arena_t *a, void *bp, size_t size);
+static int trim_heap(arena_t *a, void *bp);
+static int quick_sweep(arena_t *a);
+static void *map_alloc(size_t size);
+static void map_free(void *bp);
+static void *map_realloc(void *bp, size_t size);
+static void printblock(void *bp); 
+static int checkblock(void *bp);
+#if FIT_POLICY != FIT_NEXT
+static int checklinks(arena_t *a, void *bp);
+#endif
+#if FIT_POLICY != FIT_NEXT
+static void checkfreelists(arena_t *a, int *nlisted);
+#endif
+#if FIT_POLICY == FIT_TREE
+static void checktree(arena_t *a, void *t, size_t lo, size_t hi, int *nlisted);
+#endif
+#if DEFER_COALESCE
+static void checkquick(arena_t *a);
+#endif
+#if USE_SLABS
+static void *slab_alloc(arena_t *a, size_t size);
+static void slab_free(arena_t *a, void *p);
+static inline slab_run_t *slab_run_of(void *p);
+static void checkslabs(arena_t *a);
+#endif
 
-    return NULL;
+//
+// IS_MAPPED - Is bp a block with its own mapping?  Slab objects have
+// no header to look at, so this goes by address: mappings never lie
+// inside the heap's reservation.
+//
+static inline int IS_MAPPED(void *bp) {
+  return (uintptr_t)((char *)bp - heap_base) >= heap_span;
+}
 
+//
+// arena_of - Return the arena owning the page that holds p
+//
+static inline arena_t *arena_of(void *p) {
+  return &arenas[page_map[((char *)p - heap_base) / PAGE_GRAIN] & PAGE_ARENA];
 }
 
-// 
-// mm_free - Free a block 
+#if MM_THREADS
+static inline void arena_lock(arena_t *a) { pthread_mutex_lock(&a->lock); }
+static inline void arena_unlock(arena_t *a) { pthread_mutex_unlock(&a->lock); }
+#else
+static inline void arena_lock(arena_t *a) { }
+static inline void arena_unlock(arena_t *a) { }
+#endif
+
+#if MM_THREADS
+static void tcache_flush(void *unused);
+
 //
-void mm_free(void *bp)
+// mm_once_init - One-time setup of the arena locks and the key whose
+//                destructor flushes a thread's cache when it exits
+//
+static void mm_once_init(void)
 {
-  uint32_t size = GET_SIZE(HDRP(bp));
+  int i;
 
-  PUT(HDRP(bp), PACK(size, 0));
-  PUT(FTRP(bp), PACK(size, 0));
-  coalesce(bp);
+  for (i = 0; i < MM_ARENAS; i++)
+    pthread_mutex_init(&arenas[i].lock, NULL);
+  pthread_key_create(&tcache_key, tcache_flush);
 }
+#endif
 
 //
-// coalesce - boundary tag coalescing. Return ptr to coalesced block
+// page_map_init - Make the page map fit memlib's heap limit
+//
+// The heap's size limit is only known at run time, so the page map
+// is a mapping of its own.  Its pages are only backed once the heap
+// reaches them.
 //
-static void *coalesce(void *bp) 
+static int page_map_init(void)
 {
-  size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
-  size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-  size_t size = GET_SIZE(HDRP(bp));
-
-  if (prev_alloc && next_alloc){ /* Case 1 */
-    return bp;
-  }
-  else if(prev_alloc && !next_alloc){ /* Case 2 */
-    size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
-  }
-  else if(!prev_alloc && next_alloc){ /* Case 2 */
-    size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-    PUT(FTRP(bp), PACK(size, 0));
-    PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-    bp = PREV_BLKP(bp);
-  }
-  else{                          
-        /* Case 4 */
-    size += GET_SIZE(FTRP(NEXT_BLKP(bp))) + GET_SIZE(HDRP(PREV_BLKP(bp)));
-    PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-    PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-    bp = PREV_BLKP(bp);
+  if (mem_max_heap() != heap_span) {
+#if !WIDE_HEADERS
+    if (mem_max_heap() > ((size_t)1 << 32)) {
+      fprintf(stderr, "mm_init: heaps over 4 GB need -DWIDE_HEADERS=1\n");
+      return -1;
+    }
+#endif
+    if (page_map != NULL)
+      munmap(page_map, (heap_span + PAGE_GRAIN - 1) / PAGE_GRAIN);
+    heap_span = mem_max_heap();
+    page_map = mmap(NULL, (heap_span + PAGE_GRAIN - 1) / PAGE_GRAIN,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (page_map == MAP_FAILED) {
+      page_map = NULL;
+      heap_span = 0;
+      return -1;
+    }
+    page_hi = 0;
   }
+  return 0;
+}
 
+//
+// mm_init - Initialize the memory manager
+//
+// Not thread safe: no other thread may be inside the allocator.
+//
+int mm_init(void) {
+  int i;
 
-  if((temp > (char *)bp) && (temp < (char *)NEXT_BLKP(bp))) 
-    temp = bp;
+#if MM_THREADS
+  pthread_once(&mm_once, mm_once_init);
+#endif
 
-  return bp;
+  heap_base = mem_heap_lo();
+  if (page_map_init() != 0)
+    return -1;
+  memset(page_map, 0, page_hi);
+  page_hi = 0;
+  mm_gen++;
+
+  for (i = 0; i < MM_ARENAS; i++) {
+    arena_t *a = &arenas[i];
+
+    a->id = i;
+    a->heap_listp = NULL;
+    a->temp = NULL;
+    a->brk = NULL;
+    a->last_chunk = NULL;
+    a->check_chunk = NULL;
+    a->check_cursor = NULL;
+    a->trim_threshold = TRIM_THRESHOLD;
+    a->trimmed = 0;
+    memset(a->free_lists, 0, sizeof(a->free_lists));
+#if FIT_POLICY == FIT_TLSF
+    a->fl_bitmap = 0;
+    memset(a->sl_bitmap, 0, sizeof(a->sl_bitmap));
+#elif FIT_POLICY == FIT_TREE
+    a->bin_map = 0;
+    a->tree_root = 0;
+    a->tree_seed = 2463534242u + i;
+#endif
+#if USE_SLABS
+    memset(a->slab_partial, 0, sizeof(a->slab_partial));
+#endif
+#if DEFER_COALESCE
+    memset(a->quick, 0, sizeof(a->quick));
+    a->nquick = 0;
+#endif
+    memset(a->grow, 0, sizeof(a->grow));
+    a->grow_clock = 0;
+    a->block_bytes = 0;
+    memset(&a->st, 0, sizeof(a->st));
+  }
+  map_reallocs[0] = map_reallocs[1] = 0;
+
+  if(extend_heap(&arenas[0], CHUNKSIZE / WSIZE) == NULL)
+    return -1;
+  return 0;
 }
 
+
 //
-// mm_malloc - Allocate a block with at least size bytes of payload 
+// new_chunk - Lay out a fresh, non-adjacent chunk of size bytes at p
+//             for arena a and return its single free block
 //
-void *mm_malloc(uint32_t size) 
+//  -------------------------------------------------------
+// |  link  | hdr(8:a) | ftr(8:a) | hdr(s:f) ... | hdr(0:a) |
+//  -------------------------------------------------------
+//
+// The pad word in front of the prologue links the arena's chunks in
+// the order they were made, as a heap offset (0 ends the chain).
+//
+static void *new_chunk(arena_t *a, char *p, size_t size)
 {
-  //
-  // You need to provide this
-  //
-  uint32_t asize; /* Adjusted block size */
-  uint32_t eSize; 
-  char *bp;
-
-  /* Ignore spurious requests */
-  if(size == 0)
-    return NULL;
+  char *bp = p + CHUNK_OVERHEAD;
 
-  /* Adjust block size to include overhead and alignment reqs. */
-  if(size <= DSIZE)
-    asize = 2*DSIZE;
-  else
-    asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+  PUT(p, 0);
+  PUT(p + (1 * WSIZE), PACK(DSIZE, 1, 1));
+  PUT(p + (2 * WSIZE), PACK(DSIZE, 1, 1));
+  PUT_TAGS(bp, size - CHUNK_OVERHEAD, 1, 0);
+  PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 0, 1));
 
-  /* search for fit */
-  if((bp = find_fit(asize)) != NULL){
-    place(bp, asize);
-    return bp;
+  if (a->heap_listp == NULL) {
+    a->heap_listp = p + (2 * WSIZE);
+    a->temp = a->heap_listp;
   }
-
-  // get more memory
-  eSize = MAX(asize,CHUNKSIZE);
-  if((bp = extend_heap(eSize/WSIZE)) == NULL)
-    return NULL;
-  place(bp, asize);
+  else
+    PUT(a->last_chunk, PTR2OFF(p));
+  a->last_chunk = p;
   return bp;
-  return NULL;
-} 
+}
 
 //
+// check_merge - Blocks after bp and below end have just become part
+//               of block bp, so arena a's check cursor must not stop
+//               among them
 //
-// Practice problem 9.9
+static inline void check_merge(arena_t *a, void *bp, void *end)
+{
+  if (a->check_cursor > (char *)bp && a->check_cursor < (char *)end)
+    a->check_cursor = bp;
+}
+
 //
-// place - Place block of asize bytes at start of free block bp 
-//         and split if remainder would be at least minimum block size
+// check_tick - Count a request of this thread and take a step of
+//              mm_check_step every check_every of them
 //
-static void place(void *bp, uint32_t asize) {
-    uint32_t currSize = GET_SIZE(HDRP(bp));
-
-  if((currSize - asize) >= (2*DSIZE)){
-    PUT(HDRP(bp), PACK(asize, 1));
-    PUT(FTRP(bp), PACK(asize, 1));
-    bp = NEXT_BLKP(bp);
-    PUT(HDRP(bp), PACK(currSize - asize, 0));
-    PUT(FTRP(bp), PACK(currSize - asize, 0));
-  }
-  else{
-    PUT(HDRP(bp), PACK(currSize, 1));
-    PUT(FTRP(bp), PACK(currSize, 1));
+static inline void check_tick(void)
+{
+  if (check_every != 0 && ++check_ops >= check_every) {
+    check_ops = 0;
+    mm_check_step(check_blocks);
   }
 }
 
-
 //
-// mm_realloc -- implemented for you
+// extend_heap - Extend arena a with a free block of at least
+//               words words and return its block pointer
 //
-void *mm_realloc(void *ptr, uint32_t size)
+static void *extend_heap(arena_t *a, size_t words)
 {
-  void *newp;
-  uint32_t copySize;
+    char *bp;
+    size_t size, want;
 
-  newp = mm_malloc(size);
-  if (newp == NULL) {
-    printf("ERROR: mm_malloc failed in mm_realloc\n");
-    exit(1);
-  }
-  copySize = GET_SIZE(HDRP(ptr));
-  if (size < copySize) {
-    copySize = size;
-  }
-  memcpy(newp, ptr, copySize);
-  mm_free(ptr);
-  return newp;
+    want = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+    if (a->trimmed) {
+      /* we gave back memory we still needed */
+      a->trimmed = 0;
+      if (a->trim_threshold < TRIM_MAX)
+        a->trim_threshold *= 2;
+    }
+
+    for (;;) {
+      //
+      // If the break has moved since our last chunk, the memory we
+      // get will need its own prologue and epilogue, from the next
+      // page boundary on.
+      //
+      char *brk = (char *)mem_heap_hi() + 1, *start = brk;
+
+      size = want;
+      if (a->brk != brk) {
+        start = PAGE_ROUND(brk);
+        size += CHUNK_OVERHEAD + (start - brk);
+      }
+      if ((long)(bp = mem_sbrk_fresh_at(brk, size, &a->fresh)) == -1) {
+        if (errno == EAGAIN)
+          continue;                     /* another arena moved the break */
+        return NULL;
+      }
+      size -= start - brk;
+      bp = start;
+
+      uint32_t page = (bp - heap_base) / PAGE_GRAIN;
+      uint32_t end = (PAGE_ROUND(bp + size) - heap_base) / PAGE_GRAIN;
+      uint32_t hi = __atomic_load_n(&page_hi, __ATOMIC_RELAXED);
+      memset(page_map + page, a->id, end - page);
+      while (end > hi &&
+             !__atomic_compare_exchange_n(&page_hi, &hi, end,
+                                          1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+      STAT_ADD(a->st.extends, 1);
+      if (bp == a->brk) {
+        /* the new block starts where the old epilogue was */
+        a->brk = bp + size;
+        STAT_ADD(a->block_bytes, size);
+        PUT_TAGS(bp, size, GET_PREV_ALLOC(HDRP(bp)), 0);
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 0, 1));
+        return coalesce(a, bp);
+      }
+
+      // Not adjacent to our last chunk
+      a->brk = bp + size;
+      STAT_ADD(a->block_bytes, size - CHUNK_OVERHEAD);
+      return coalesce(a, new_chunk(a, bp, size));
+    }
 }
 
+
 //
-// mm_checkheap - Check the heap for consistency 
+// Practice problem 9.8
+//
+// find_fit - Find a fit for a block with asize bytes
 //
-void mm_checkheap(int verbose) 
+#if FIT_POLICY == FIT_NEXT
+static void *find_fit(arena_t *a, size_t asize)
 {
-  //
-  // This provided implementation assumes you're using the structure
-  // of the sample solution in the text. If not, omit this code
-  // and provide your own mm_checkheap
-  //
-  void *bp = heap_listp;
-  
-  if (verbose) {
-    printf("Heap (%p):\n", heap_listp);
-  }
+    char *oldtemp = a->temp;
 
-  if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp))) {
-	printf("Bad prologue header\n");
-  }
-  checkblock(heap_listp);
+    for( ; GET_SIZE(HDRP(a->temp)) > 0; a->temp = NEXT_BLKP(a->temp)){
+      if(!GET_ALLOC(HDRP(a->temp)) && (asize <= GET_SIZE(HDRP(a->temp)))){ return a->temp; }
+    }
 
-  for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-    if (verbose)  {
-      printblock(bp);
+    for(a->temp = a->heap_listp; a->temp < oldtemp; a->temp = NEXT_BLKP(a->temp)){
+        if(!GET_ALLOC(HDRP(a->temp)) && (asize <= GET_SIZE(HDRP(a->temp)))) { return a->temp; }
     }
-    checkblock(bp);
-  }
-     
-  if (verbose) {
-    printblock(bp);
-  }
 
-  if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp)))) {
-    printf("Bad epilogue header\n");
-  }
-}
+    return NULL;
 
-static void printblock(void *bp) 
+}
+#elif FIT_POLICY == FIT_TLSF
+static void *find_fit(arena_t *a, size_t asize)
 {
-  uint32_t hsize, halloc, fsize, falloc;
+    int fl, sl;
+    word_t map;
 
-  hsize = GET_SIZE(HDRP(bp));
-  halloc = GET_ALLOC(HDRP(bp));  
-  fsize = GET_SIZE(FTRP(bp));
-  falloc = GET_ALLOC(FTRP(bp));  
-    
-  if (hsize == 0) {
-    printf("%p: EOL\n", bp);
-    return;
-  }
+    //
+    // Round asize up to the start of the next second-level range
+    // so every block on the list we land on is large enough.
+    //
+    if (asize >= (1 << FL_SHIFT)) {
+      size_t round = ((size_t)1 << (LOG2(asize) - SL_LOG2)) - 1;
+      if (asize + round < asize)
+        return NULL;
+      asize += round;
+    }
+    tlsf_mapping(asize, &fl, &sl);
+    if (fl >= FL_COUNT)
+      return NULL;
+
+    map = a->sl_bitmap[fl] & (~0u << sl);
+    if (map == 0) {
+      map = (fl + 1 < FL_COUNT) ? a->fl_bitmap & (~(word_t)0 << (fl + 1)) : 0;
+      if (map == 0)
+        return NULL;
+      fl = __builtin_ctzll(map);
+      map = a->sl_bitmap[fl];
+    }
+    sl = __builtin_ctzll(map);
 
-  printf("%p: header: [%d:%c] footer: [%d:%c]\n",
-	 bp, 
-	 (int) hsize, (halloc ? 'a' : 'f'), 
-	 (int) fsize, (falloc ? 'a' : 'f')); 
+    return OFF2PTR(a->free_lists[fl * SL_COUNT + sl]);
 }
+#elif FIT_POLICY == FIT_TREE
+static void *find_fit(arena_t *a, size_t asize)
+{
+    uint64_t map;
 
-static void checkblock(void *bp) 
+    //
+    // Every block in a bin has exactly that bin's size, so the first
+    // non-empty bin at or above asize is the best fit; past the bins,
+    // ask the treap.
+    //
+    if (asize <= TREE_MIN) {
+      map = a->bin_map & (~(uint64_t)0 << size_class(asize));
+      if (map != 0)
+        return OFF2PTR(a->free_lists[__builtin_ctzll(map)]);
+    }
+    return tree_best_fit(a, asize);
+}
+#else
+static void *find_fit(arena_t *a, size_t asize)
 {
-  if ((uintptr_t)bp % 8) {
-    printf("Error: %p is not doubleword aligned\n", bp);
-  }
-  if (GET(HDRP(bp)) != GET(FTRP(bp))) {
-    printf("Error: header does not match footer\n");
-  }
-}
\ No newline at end of file
+    int c;
+    void *bp;
+
+    //
+    // First fit within the class that asize maps to; any block in
+    // a larger class is big enough, so the head of the first
+    // non-empty one will do.
+    //
+    for(c = size_class(asize); c < NUM_CLASSES; c++){
+      for(bp = OFF2PTR(a->free_lists[c]); bp != NULL; bp = NEXT_FREE(bp)){
+        if(asize <= GET_SIZE(HDRP(bp))){ return bp; }
+      }
+    }
+
+    return NULL;
+}
+#endif
+
+//
+// insert_free - Add free block bp to its size class, at the head or
+//               in address order as LIST_ORDER says
+// remove_free - Unlink free block bp from its size class
+//
+// Both keep the arena's free counters, the largest free size among
+// them: a larger block raises it, and taking out a block of that size
+// asks the fit index for the new one.  Beyond that they are no-ops
+// for the implicit-list engine, which finds free blocks by walking
+// the heap.
+//
+static void insert_free(arena_t *a, void *bp)
+{
+  size_t size = GET_SIZE(HDRP(bp));
+
+  STAT_ADD(a->st.free_bytes, size);
+  STAT_ADD(a->st.free_blocks[LOG2(size)], 1);
+  if (size > a->st.largest_free)
+    STAT_SET(a->st.largest_free, size);
+#if FIT_POLICY != FIT_NEXT
+  int c;
+  void *head;
+
+#if FIT_POLICY == FIT_TREE
+  if (size > TREE_MIN) {
+    tree_insert(a, bp);
+    return;
+  }
+#endif
+  c = size_class(size);
+  head = OFF2PTR(a->free_lists[c]);
+
+#if LIST_ORDER == LIST_ADDR
+  /* in front of the first block above bp */
+  void *prev = NULL;
+
+  while (head != NULL && (char *)head < (char *)bp) {
+    prev = head;
+    head = NEXT_FREE(head);
+  }
+  PUT(NEXT_FREEP(bp), PTR2OFF(head));
+  PUT(PREV_FREEP(bp), PTR2OFF(prev));
+  if (head != NULL)
+    PUT(PREV_FREEP(head), PTR2OFF(bp));
+  if (prev != NULL) {
+    PUT(NEXT_FREEP(prev), PTR2OFF(bp));
+    return;
+  }
+#else
+  PUT(NEXT_FREEP(bp), a->free_lists[c]);
+  PUT(PREV_FREEP(bp), 0);
+  if (head != NULL)
+    PUT(PREV_FREEP(head), PTR2OFF(bp));
+#endif
+  a->free_lists[c] = PTR2OFF(bp);
+#if FIT_POLICY == FIT_TLSF
+  a->fl_bitmap |= (word_t)1 << (c / SL_COUNT);
+  a->sl_bitmap[c / SL_COUNT] |= 1u << (c % SL_COUNT);
+#elif FIT_POLICY == FIT_TREE
+  a->bin_map |= (uint64_t)1 << c;
+#endif
+#endif
+}
+
+static void remove_free(arena_t *a, void *bp)
+{
+  size_t size = GET_SIZE(HDRP(bp));
+
+  STAT_SUB(a->st.free_bytes, size);
+  STAT_SUB(a->st.free_blocks[LOG2(size)], 1);
+  unlink_free(a, bp, size);
+  if (size == a->st.largest_free)
+    STAT_SET(a->st.largest_free, largest_free(a));
+}
+
+//
+// unlink_free - Take free block bp, of the given size, out of the fit
+//               index
+//
+static void unlink_free(arena_t *a, void *bp, size_t size)
+{
+#if FIT_POLICY != FIT_NEXT
+  void *next, *prev;
+
+#if FIT_POLICY == FIT_TREE
+  if (size > TREE_MIN) {
+    tree_remove(a, bp);
+    return;
+  }
+#endif
+  next = NEXT_FREE(bp);
+  prev = PREV_FREE(bp);
+  if (prev != NULL)
+    PUT(NEXT_FREEP(prev), GET(NEXT_FREEP(bp)));
+  else {
+    int c = size_class(size);
+    a->free_lists[c] = GET(NEXT_FREEP(bp));
+#if FIT_POLICY == FIT_TLSF
+    if (a->free_lists[c] == 0) {
+      a->sl_bitmap[c / SL_COUNT] &= ~(1u << (c % SL_COUNT));
+      if (a->sl_bitmap[c / SL_COUNT] == 0)
+        a->fl_bitmap &= ~((word_t)1 << (c / SL_COUNT));
+    }
+#elif FIT_POLICY == FIT_TREE
+    if (a->free_lists[c] == 0)
+      a->bin_map &= ~((uint64_t)1 << c);
+#endif
+  }
+  if (next != NULL)
+    PUT(PREV_FREEP(next), GET(PREV_FREEP(bp)));
+#endif
+}
+
+#if FIT_POLICY == FIT_TREE
+/////////////////////////////////////////////////////////////////////////////
+//
+// Treap of large free blocks
+//
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// tree_relink - Make whatever pointed at old (its parent's child
+//               link, or the root) point at new instead
+//
+static void tree_relink(arena_t *a, void *parent, void *old, void *new)
+{
+  if (parent == NULL)
+    a->tree_root = PTR2OFF(new);
+  else if (LEFT(parent) == old)
+    PUT(LEFTP(parent), PTR2OFF(new));
+  else
+    PUT(RIGHTP(parent), PTR2OFF(new));
+}
+
+//
+// tree_rotate_up - Rotate node x above its parent
+//
+static void tree_rotate_up(arena_t *a, void *x)
+{
+  void *p = PARENT(x);
+  void *g = PARENT(p);
+  void *b;
+
+  if (LEFT(p) == x) {
+    b = RIGHT(x);
+    PUT(LEFTP(p), PTR2OFF(b));
+    PUT(RIGHTP(x), PTR2OFF(p));
+  }
+  else {
+    b = LEFT(x);
+    PUT(RIGHTP(p), PTR2OFF(b));
+    PUT(LEFTP(x), PTR2OFF(p));
+  }
+  if (b != NULL)
+    PUT(PARENTP(b), PTR2OFF(p));
+  PUT(PARENTP(p), PTR2OFF(x));
+  PUT(PARENTP(x), PTR2OFF(g));
+  tree_relink(a, g, p, x);
+}
+
+//
+// tree_insert - Add free block bp (above TREE_MIN) to the treap
+//
+static void tree_insert(arena_t *a, void *bp)
+{
+  size_t size = GET_SIZE(HDRP(bp));
+  uint32_t prio;
+  void *t = OFF2PTR(a->tree_root), *parent = NULL, *n;
+
+  while (t != NULL) {
+    size_t tsize = GET_SIZE(HDRP(t));
+
+    if (tsize == size) {
+      /* join t's list, right behind t */
+      n = NEXT_FREE(t);
+      PUT(NEXT_FREEP(bp), PTR2OFF(n));
+      PUT(PREV_FREEP(bp), PTR2OFF(t));
+      if (n != NULL)
+        PUT(PREV_FREEP(n), PTR2OFF(bp));
+      PUT(NEXT_FREEP(t), PTR2OFF(bp));
+      return;
+    }
+    parent = t;
+    t = size < tsize ? LEFT(t) : RIGHT(t);
+  }
+
+  prio = a->tree_seed;
+  prio ^= prio << 13;
+  prio ^= prio >> 17;
+  prio ^= prio << 5;
+  a->tree_seed = prio;
+
+  PUT(NEXT_FREEP(bp), 0);
+  PUT(PREV_FREEP(bp), 0);
+  PUT(LEFTP(bp), 0);
+  PUT(RIGHTP(bp), 0);
+  PUT(PARENTP(bp), PTR2OFF(parent));
+  PUT(PRIOP(bp), prio);
+  if (parent == NULL)
+    a->tree_root = PTR2OFF(bp);
+  else if (size < GET_SIZE(HDRP(parent)))
+    PUT(LEFTP(parent), PTR2OFF(bp));
+  else
+    PUT(RIGHTP(parent), PTR2OFF(bp));
+
+  while ((parent = PARENT(bp)) != NULL && GET(PRIOP(parent)) < prio)
+    tree_rotate_up(a, bp);
+}
+
+//
+// tree_remove - Take free block bp (above TREE_MIN) out of the treap
+//
+static void tree_remove(arena_t *a, void *bp)
+{
+  void *next = NEXT_FREE(bp), *prev = PREV_FREE(bp);
+  void *l, *r, *child;
+
+  if (prev != NULL) {
+    /* on a node's list: a plain unlink */
+    PUT(NEXT_FREEP(prev), PTR2OFF(next));
+    if (next != NULL)
+      PUT(PREV_FREEP(next), PTR2OFF(prev));
+    return;
+  }
+
+  if (next != NULL) {
+    //
+    // Another block of the same size takes over bp's place in the
+    // tree, priority included, so the shape does not change.
+    //
+    PUT(PREV_FREEP(next), 0);
+    PUT(LEFTP(next), GET(LEFTP(bp)));
+    PUT(RIGHTP(next), GET(RIGHTP(bp)));
+    PUT(PARENTP(next), GET(PARENTP(bp)));
+    PUT(PRIOP(next), GET(PRIOP(bp)));
+    if ((l = LEFT(bp)) != NULL)
+      PUT(PARENTP(l), PTR2OFF(next));
+    if ((r = RIGHT(bp)) != NULL)
+      PUT(PARENTP(r), PTR2OFF(next));
+    tree_relink(a, PARENT(bp), bp, next);
+    return;
+  }
+
+  /* rotate bp down until it has at most one child, then splice it out */
+  while ((l = LEFT(bp)) != NULL && (r = RIGHT(bp)) != NULL)
+    tree_rotate_up(a, GET(PRIOP(l)) > GET(PRIOP(r)) ? l : r);
+  child = l != NULL ? l : RIGHT(bp);
+  if (child != NULL)
+    PUT(PARENTP(child), GET(PARENTP(bp)));
+  tree_relink(a, PARENT(bp), bp, child);
+}
+
+//
+// tree_best_fit - Return the smallest free block of at least asize
+//                 bytes in the treap, or NULL
+//
+// A list member is preferred over the node it hangs off, because it
+// can be unlinked without touching the tree.
+//
+static void *tree_best_fit(arena_t *a, size_t asize)
+{
+  void *t = OFF2PTR(a->tree_root), *best = NULL;
+
+  while (t != NULL) {
+    size_t tsize = GET_SIZE(HDRP(t));
+
+    if (tsize >= asize) {
+      best = t;
+      if (tsize == asize)
+        break;
+      t = LEFT(t);
+    }
+    else
+      t = RIGHT(t);
+  }
+  if (best != NULL && NEXT_FREE(best) != NULL)
+    return NEXT_FREE(best);
+  return best;
+}
+#endif
+
+#if MM_THREADS
+/////////////////////////////////////////////////////////////////////////////
+//
+// Thread caches
+//
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// tcache_bin - Return the cache bin that serves a request of size
+//              bytes, or -1 if such requests bypass the cache
+//
+static inline int tcache_bin(size_t size)
+{
+  size_t asize;
+
+#if USE_SLABS
+  if (size <= SLAB_MAX)
+    return (size + DSIZE - 1) / DSIZE - 1;
+#endif
+  asize = adjust_size(size);
+  return asize <= TCACHE_MAX ? (int)(SLAB_CLASSES + asize / DSIZE) : -1;
+}
+
+//
+// tcache_block_bin - Return the bin a freed block belongs in, or -1
+//
+// This runs without the arena lock.  The owner may rewrite the
+// prev-alloc bit of bp's header concurrently, but the size bits of an
+// allocated block never change under it.
+//
+static inline int tcache_block_bin(void *bp)
+{
+  word_t size;
+
+#if USE_SLABS
+  slab_run_t *run = slab_run_of(bp);
+  if (run != NULL)
+    return run->objsize / DSIZE - 1;
+#endif
+  size = __atomic_load_n((word_t *)HDRP(bp), __ATOMIC_RELAXED) & ~0x7;
+#if USE_SLABS
+  //
+  // Smaller blocks only come from shrinking realloc; a request of
+  // that size would be served by a slab, so don't cache them.
+  //
+  if (size < adjust_size(SLAB_MAX + 1))
+    return -1;
+#endif
+  if (size < LINK_MIN)
+    return -1;
+  return size <= TCACHE_MAX ? (int)(SLAB_CLASSES + size / DSIZE) : -1;
+}
+
+//
+// tcache_bin_size - The size of the blocks in cache bin bin
+//
+static inline size_t tcache_bin_size(int bin)
+{
+  if (bin < SLAB_CLASSES)
+    return (size_t)(bin + 1) * DSIZE;
+  return (size_t)(bin - SLAB_CLASSES) * DSIZE;
+}
+
+//
+// tcache_reset - Drop a cache filled before the last mm_init
+//
+static inline void tcache_reset(void)
+{
+  if (tcache.gen != mm_gen) {
+    tcache.bytes = 0;
+    memset(tcache.head, 0, sizeof(tcache.head));
+    tcache.gen = mm_gen;
+  }
+}
+
+static inline void *tcache_get(int bin)
+{
+  void *bp;
+
+  if (!__atomic_load_n(&tcache_on, __ATOMIC_RELAXED))
+    return NULL;
+  tcache_reset();
+  if ((bp = tcache.head[bin]) == NULL)
+    return NULL;
+  tcache.head[bin] = *(void **)bp;
+  tcache.bytes -= tcache_bin_size(bin);
+  return bp;
+}
+
+static inline int tcache_put(int bin, void *bp)
+{
+  if (!__atomic_load_n(&tcache_on, __ATOMIC_RELAXED))
+    return 0;
+  tcache_reset();
+  if (tcache.bytes + tcache_bin_size(bin) > TCACHE_BYTES)
+    return 0;
+  if (!tcache.registered) {
+    pthread_setspecific(tcache_key, &tcache);
+    tcache.registered = 1;
+  }
+  *(void **)bp = tcache.head[bin];
+  tcache.head[bin] = bp;
+  tcache.bytes += tcache_bin_size(bin);
+  return 1;
+}
+
+//
+// tcache_flush - Give every cached block back to its arena; runs as
+//                the thread-exit destructor of tcache_key
+//
+static void tcache_flush(void *unused)
+{
+  int bin;
+  void *bp;
+  arena_t *a;
+
+  (void)unused;
+  if (tcache.gen != mm_gen)
+    return;
+  for (bin = 0; bin < TCACHE_BINS; bin++) {
+    while ((bp = tcache.head[bin]) != NULL) {
+      tcache.head[bin] = *(void **)bp;
+      a = arena_of(bp);
+      arena_lock(a);
+      arena_free(a, bp);
+      arena_unlock(a);
+    }
+  }
+  tcache.bytes = 0;
+  tcache.registered = 0;
+}
+
+//
+// my_arena - Return the calling thread's arena, assigning one
+//            round-robin on first use; the second thread to get
+//            one turns the thread caches on
+//
+static inline arena_t *my_arena(void)
+{
+  uint32_t n;
+
+  if (thread_arena == NULL) {
+    n = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+    if (n == 1)
+      __atomic_store_n(&tcache_on, 1, __ATOMIC_RELAXED);
+    thread_arena = &arenas[n % MM_ARENAS];
+  }
+  return thread_arena;
+}
+#else
+static inline arena_t *my_arena(void) { return &arenas[0]; }
+#endif
+
+#if DEFER_COALESCE
+/////////////////////////////////////////////////////////////////////////////
+//
+// Quick lists
+//
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// quick_push/quick_pop - Keep an allocated block of size bytes on the
+//                        quick list of that size.  As in the thread
+//                        cache, its first word links the list.
+//
+static inline void quick_push(arena_t *a, void *bp, size_t size)
+{
+  *(void **)bp = a->quick[size / DSIZE];
+  a->quick[size / DSIZE] = bp;
+  a->nquick++;
+}
+
+static inline void *quick_pop(arena_t *a, size_t size)
+{
+  void *bp = a->quick[size / DSIZE];
+
+  if (bp != NULL) {
+    a->quick[size / DSIZE] = *(void **)bp;
+    a->nquick--;
+  }
+  return bp;
+}
+
+//
+// quick_merge - Merge two address-ordered quick lists
+//
+static void *quick_merge(void *x, void *y)
+{
+  void *head, **tail = &head;
+
+  while (x != NULL && y != NULL) {
+    if ((char *)x < (char *)y) {
+      *tail = x;
+      x = *(void **)x;
+    }
+    else {
+      *tail = y;
+      y = *(void **)y;
+    }
+    tail = (void **)*tail;
+  }
+  *tail = (x != NULL) ? x : y;
+  return head;
+}
+
+//
+// quick_sweep - Free everything on the quick lists of arena a, in one
+//               pass up the heap.  Returns 0 if they were empty.
+//
+// The lists are merged into one in address order (a bottom-up merge
+// sort on the links, so nothing is allocated), and blocks that turn
+// out to be neighbours are freed together as one span, as in
+// mm_free_batch.  Coalescing then only ever meets free blocks, never
+// a quick block further up the list.
+//
+static int quick_sweep(arena_t *a)
+{
+  void *part[64];               /* part[i] is a sorted list of 2^i blocks, or NULL */
+  void *list, *bp, *next;
+  size_t size;
+  int c, i;
+
+  if (a->nquick == 0)
+    return 0;
+
+  memset(part, 0, sizeof(part));
+  for (c = 0; c < QUICK_BINS; c++) {
+    for (bp = a->quick[c]; bp != NULL; bp = next) {
+      next = *(void **)bp;
+      *(void **)bp = NULL;
+      for (list = bp, i = 0; part[i] != NULL; i++) {
+        list = quick_merge(part[i], list);
+        part[i] = NULL;
+      }
+      part[i] = list;
+    }
+    a->quick[c] = NULL;
+  }
+  a->nquick = 0;
+  for (list = NULL, i = 0; i < 64; i++)
+    if (part[i] != NULL)
+      list = quick_merge(part[i], list);
+
+  while (list != NULL) {
+    bp = list;
+    size = GET_SIZE(HDRP(bp));
+    for (list = *(void **)bp; list == (char *)bp + size; list = *(void **)list)
+      size += GET_SIZE(HDRP(list));
+    free_span(a, bp, size);
+  }
+  return 1;
+}
+#else
+static inline int quick_sweep(arena_t *a) { (void)a; return 0; }
+#endif
+
+//
+// mm_free - Free a block
+//
+void mm_free(void *bp)
+{
+  if (bp == NULL)
+    return;
+  check_tick();
+  free_block(bp);
+}
+
+//
+// free_block - mm_free less the request count, for mm_realloc to
+//              free with
+//
+static void free_block(void *bp)
+{
+  arena_t *a;
+
+  if (IS_MAPPED(bp)) {
+    map_free(bp);
+    return;
+  }
+
+  a = arena_of(bp);
+#if MM_THREADS
+  int bin = tcache_block_bin(bp);
+  if (bin >= 0 && !grow_listed(a, bp) && tcache_put(bin, bp))
+    return;
+#endif
+
+  arena_lock(a);
+  arena_free(a, bp);
+  arena_unlock(a);
+}
+
+//
+// arena_free - Free block bp, which belongs to arena a (locked)
+//
+static void arena_free(arena_t *a, void *bp)
+{
+  size_t size;
+
+#if USE_SLABS
+  if (slab_run_of(bp) != NULL) {
+    slab_free(a, bp);
+    return;
+  }
+#endif
+
+  grow_forget(a, bp);
+  size = GET_SIZE(HDRP(bp));
+#if DEFER_COALESCE
+  if (size <= QUICK_MAX && size >= LINK_MIN) {
+    quick_push(a, bp, size);
+    return;
+  }
+#endif
+  free_span(a, bp, size);
+}
+
+//
+// free_span - Free the size bytes of allocated blocks that start at
+//             bp as one block, coalescing it with its neighbours
+//
+static void free_span(arena_t *a, void *bp, size_t size)
+{
+  char *lo, *hi;
+
+  //
+  // Neighbours at or above RELEASE_THRESHOLD were released when they
+  // were freed, so only [lo, hi) can hold pages that are still
+  // resident.
+  //
+  lo = bp;
+  hi = (char *)bp + size;
+  if (!GET_PREV_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(PREV_BLKP(bp))) < RELEASE_THRESHOLD)
+    lo = PREV_BLKP(bp);
+  if (!GET_ALLOC(HDRP(hi)) && GET_SIZE(HDRP(hi)) < RELEASE_THRESHOLD)
+    hi += GET_SIZE(HDRP(hi));
+
+  PUT_TAGS(bp, size, GET_PREV_ALLOC(HDRP(bp)), 0);
+  bp = coalesce(a, bp);
+
+  size = GET_SIZE(HDRP(bp));
+  if (size >= a->trim_threshold && trim_heap(a, bp))
+    return;
+  if (size >= RELEASE_THRESHOLD) {
+    //
+    // Keep the header, the links and the footer intact; everything in
+    // between may come back zeroed.  A treap node's links run through
+    // its prio word.
+    //
+    char *links = (char *)bp + DSIZE;
+
+#if FIT_POLICY == FIT_TREE
+    if (size > TREE_MIN)
+      links = (char *)PRIOP(bp) + WSIZE;
+#endif
+    if (lo < links)
+      lo = links;
+    if (hi > (char *)FTRP(bp))
+      hi = FTRP(bp);
+    if (hi - lo >= RELEASE_MIN)
+      mem_release(lo, hi - lo);
+  }
+}
+
+//
+// ptr_cmp - qsort comparison of two pointers by address
+//
+static int ptr_cmp(const void *x, const void *y)
+{
+  uintptr_t p = (uintptr_t)*(void * const *)x;
+  uintptr_t q = (uintptr_t)*(void * const *)y;
+
+  return (p > q) - (p < q);
+}
+
+//
+// mm_free_batch - Free the n blocks in ptrs[], which is left sorted
+//                 by address
+//
+// Sorting brings the blocks of each arena together, so an arena is
+// locked once per stretch of its blocks rather than once per block,
+// and it lines up blocks that were allocated back to back (as
+// mm_malloc_batch hands them out).  Such a run is retagged as one
+// free block and coalesced with its neighbours once.  The thread
+// cache is bypassed, since what it would save is the lock.
+//
+void mm_free_batch(void **ptrs, size_t n)
+{
+  arena_t *a = NULL, *owner;
+  size_t i, j, size;
+  char *bp;
+
+  check_tick();
+  qsort(ptrs, n, sizeof(void *), ptr_cmp);
+  for (i = 0; i < n; i = j) {
+    bp = ptrs[i];
+    j = i + 1;
+    if (bp == NULL)
+      continue;
+    if (IS_MAPPED(bp)) {
+      map_free(bp);
+      continue;
+    }
+
+    owner = arena_of(bp);
+    if (owner != a) {
+      if (a != NULL)
+        arena_unlock(a);
+      a = owner;
+      arena_lock(a);
+    }
+#if USE_SLABS
+    if (slab_run_of(bp) != NULL) {
+      slab_free(a, bp);
+      continue;
+    }
+#endif
+
+    grow_forget(a, bp);
+    size = GET_SIZE(HDRP(bp));
+    while (j < n && ptrs[j] == bp + size) {
+      grow_forget(a, ptrs[j]);
+      size += GET_SIZE(HDRP(ptrs[j]));
+      j++;
+    }
+    free_span(a, bp, size);
+  }
+  if (a != NULL)
+    arena_unlock(a);
+}
+
+//
+// trim_heap - If free block bp ends the newest chunk of arena a and
+//             that chunk is at the top of the heap, give all but
+//             TRIM_PAD bytes of it back.  Returns 1 if it did.
+//
+static int trim_heap(arena_t *a, void *bp)
+{
+  size_t size = GET_SIZE(HDRP(bp));
+  size_t cut = (size - TRIM_PAD) & ~(PAGE_GRAIN - 1);
+  int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+  char *old_brk = a->brk;
+
+  if ((char *)NEXT_BLKP(bp) != old_brk || cut == 0)
+    return 0;
+
+  //
+  // Lay out the shorter block and its epilogue before moving the
+  // break: mem_sbrk_at loses the cut bytes even if it fails.
+  //
+  remove_free(a, bp);
+  PUT_TAGS(bp, size - cut, prev_alloc, 0);
+  PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 0, 1));
+  if (mem_sbrk_at(old_brk, -(intptr_t)cut) == (void *)-1) {
+    PUT_TAGS(bp, size, prev_alloc, 0);
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 0, 1));
+    insert_free(a, bp);
+    return 0;
+  }
+  a->brk = old_brk - cut;
+  STAT_SUB(a->block_bytes, cut);
+  a->trimmed = 1;
+  insert_free(a, bp);
+  check_merge(a, bp, old_brk + WSIZE);   /* the old epilogue too */
+#if FIT_POLICY == FIT_NEXT
+  if (a->temp > (char *)bp)
+    a->temp = bp;
+#endif
+  return 1;
+}
+
+//
+// coalesce - boundary tag coalescing. Return ptr to coalesced block
+//
+// bp must not be on a free list yet; any free neighbours are
+// unlinked, merged, and the result is placed on its size class.
+//
+static void *coalesce(arena_t *a, void *bp)
+{
+  size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+  size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+  size_t size = GET_SIZE(HDRP(bp));
+
+  if (prev_alloc && next_alloc){ /* Case 1 */
+    /* nothing to merge */
+  }
+  else if(prev_alloc && !next_alloc){ /* Case 2 */
+    remove_free(a, NEXT_BLKP(bp));
+    size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+    PUT_TAGS(bp, size, 1, 0);
+    STAT_ADD(a->st.coalesces, 1);
+  }
+  else if(!prev_alloc && next_alloc){ /* Case 3 */
+    bp = PREV_BLKP(bp);
+    remove_free(a, bp);
+    size += GET_SIZE(HDRP(bp));
+    PUT_TAGS(bp, size, GET_PREV_ALLOC(HDRP(bp)), 0);
+    STAT_ADD(a->st.coalesces, 1);
+  }
+  else{
+        /* Case 4 */
+    remove_free(a, PREV_BLKP(bp));
+    remove_free(a, NEXT_BLKP(bp));
+    size += GET_SIZE(HDRP(NEXT_BLKP(bp))) + GET_SIZE(HDRP(PREV_BLKP(bp)));
+    bp = PREV_BLKP(bp);
+    PUT_TAGS(bp, size, GET_PREV_ALLOC(HDRP(bp)), 0);
+    STAT_ADD(a->st.coalesces, 2);
+  }
+
+  SET_PREV_ALLOC(NEXT_BLKP(bp), 0);
+  insert_free(a, bp);
+  check_merge(a, bp, NEXT_BLKP(bp));
+
+#if FIT_POLICY == FIT_NEXT
+  if((a->temp > (char *)bp) && (a->temp < (char *)NEXT_BLKP(bp)))
+    a->temp = bp;
+#endif
+
+  return bp;
+}
+
+//
+// mm_malloc - Allocate a block with at least size bytes of payload
+//
+void *mm_malloc(size_t size)
+{
+  /* Ignore spurious requests */
+  if(size == 0)
+    return NULL;
+  check_tick();
+  return malloc_block(size);
+}
+
+//
+// malloc_block - mm_malloc of a non-zero size less the request count,
+//                for the other entry points to allocate with
+//
+static void *malloc_block(size_t size)
+{
+  arena_t *a;
+  void *bp;
+
+  if (size >= MMAP_THRESHOLD)
+    return map_alloc(size);
+
+#if MM_THREADS
+  int bin = tcache_bin(size);
+  if (bin >= 0 && (bp = tcache_get(bin)) != NULL)
+    return bp;
+#endif
+
+  a = my_arena();
+  arena_lock(a);
+  bp = arena_malloc(a, size, NULL);
+  arena_unlock(a);
+  return bp;
+}
+
+//
+// arena_malloc - Allocate size bytes from arena a (locked)
+//
+//
+// If fresh is not NULL, *fresh is set when the block was carved from
+// heap memory that was never used before (see mm_calloc); it is left
+// alone otherwise.
+//
+static void *arena_malloc(arena_t *a, size_t size, int *fresh)
+{
+  size_t asize; /* Adjusted block size */
+  size_t eSize;
+  char *bp;
+
+  grow_age(a);
+#if USE_SLABS
+  if(size <= SLAB_MAX)
+    return slab_alloc(a, size);
+#endif
+
+  /* Adjust block size to include overhead and alignment reqs. */
+  asize = adjust_size(size);
+
+#if DEFER_COALESCE
+  if (asize <= QUICK_MAX && (bp = quick_pop(a, asize)) != NULL)
+    return bp;
+#endif
+
+  /* search for fit, coalescing the quick lists if there is none */
+  if((bp = find_fit(a, asize)) != NULL ||
+     (quick_sweep(a) && (bp = find_fit(a, asize)) != NULL)){
+    place(a, bp, asize);
+    return bp;
+  }
+
+  // get more memory
+  eSize = MAX(asize,CHUNKSIZE);
+  if((bp = extend_heap(a, eSize/WSIZE)) == NULL)
+    return NULL;
+  place(a, bp, asize);
+  if (fresh != NULL && bp >= (char *)a->fresh)
+    *fresh = 1;
+  return bp;
+}
+
+//
+// mm_malloc_batch - Allocate n blocks of at least size bytes each,
+//                   storing them in ptrs[].  Returns how many it
+//                   allocated, which is less than n only when memory
+//                   runs out.
+//
+// Heap blocks are carved back to back out of as few free blocks as
+// possible: one fit search and one split for a run of blocks rather
+// than one per block.  When no free block holds the whole run, the
+// run is halved until one does, and blocks that fit nowhere come from
+// one heap extension.  Slab objects and mappings are taken one by
+// one, as is whatever the thread cache holds.
+//
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs)
+{
+  arena_t *a;
+  size_t i = 0, k, asize, most;
+  void *bp;
+
+  if (size == 0)
+    return 0;
+  check_tick();
+  if (size >= MMAP_THRESHOLD) {
+    for (; i < n && (ptrs[i] = map_alloc(size)) != NULL; i++)
+      ;
+    return i;
+  }
+
+#if MM_THREADS
+  int bin = tcache_bin(size);
+  if (bin >= 0)
+    for (; i < n && (ptrs[i] = tcache_get(bin)) != NULL; i++)
+      ;
+#endif
+
+  a = my_arena();
+  arena_lock(a);
+#if USE_SLABS
+  if (size <= SLAB_MAX) {
+    for (; i < n && (ptrs[i] = slab_alloc(a, size)) != NULL; i++)
+      ;
+    arena_unlock(a);
+    return i;
+  }
+#endif
+
+  asize = adjust_size(size);
+#if DEFER_COALESCE
+  if (asize <= QUICK_MAX)
+    for (; i < n && (ptrs[i] = quick_pop(a, asize)) != NULL; i++)
+      ;
+#endif
+  most = MAX(BATCH_RUN / asize, 1);
+  while (i < n) {
+    k = (n - i < most) ? n - i : most;
+    while ((bp = find_fit(a, k * asize)) == NULL && k > 1)
+      k /= 2;
+    if (bp == NULL && quick_sweep(a))
+      continue;
+    if (bp == NULL) {
+      k = (n - i < most) ? n - i : most;
+      if ((bp = extend_heap(a, MAX(k * asize, CHUNKSIZE) / WSIZE)) == NULL)
+        break;
+    }
+    place_run(a, bp, asize, k, ptrs + i);
+    i += k;
+  }
+  arena_unlock(a);
+  return i;
+}
+
+//
+//
+// Practice problem 9.9
+//
+// place - Place block of asize bytes at start of free block bp
+//         and split if remainder would be at least minimum block size
+//
+static void place(arena_t *a, void *bp, size_t asize) {
+    size_t currSize = GET_SIZE(HDRP(bp));
+
+  remove_free(a, bp);
+  if((currSize - asize) >= SPLIT_MIN){
+    PUT_TAGS(bp, asize, GET_PREV_ALLOC(HDRP(bp)), 1);
+    bp = NEXT_BLKP(bp);
+    PUT_TAGS(bp, currSize - asize, 1, 0);
+    insert_free(a, bp);
+    STAT_ADD(a->st.splits, 1);
+  }
+  else{
+    PUT_TAGS(bp, currSize, GET_PREV_ALLOC(HDRP(bp)), 1);
+    SET_PREV_ALLOC(NEXT_BLKP(bp), 1);
+  }
+}
+
+
+//
+// place_run - Place k blocks of asize bytes back to back at the start
+//             of free block bp, which holds at least k * asize bytes,
+//             storing them in ptrs[].  The rest is split off as in
+//             place, or goes to the last block if it is too small.
+//
+static void place_run(arena_t *a, void *bp, size_t asize, size_t k, void **ptrs)
+{
+  size_t rest = GET_SIZE(HDRP(bp)) - k * asize;
+  int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+  size_t j;
+
+  remove_free(a, bp);
+  for (j = 0; j < k; j++) {
+    PUT_TAGS(bp, (j == k - 1 && rest < SPLIT_MIN) ? asize + rest : asize,
+             prev_alloc, 1);
+    prev_alloc = 1;
+    ptrs[j] = bp;
+    bp = NEXT_BLKP(bp);
+  }
+  STAT_ADD(a->st.splits, k - 1);
+  if (rest >= SPLIT_MIN) {
+    PUT_TAGS(bp, rest, 1, 0);
+    insert_free(a, bp);
+    STAT_ADD(a->st.splits, 1);
+  }
+  else
+    SET_PREV_ALLOC(bp, 1);
+}
+
+//
+// place_aligned - Allocate asize bytes from free block bp such that the
+//                 payload is align-aligned
+//
+// The caller guarantees bp has room for the gap in front of the
+// aligned payload (0 or at least MIN_BLOCK bytes) plus asize.  The
+// gap and any large enough tail go back on the free lists.
+//
+static void *place_aligned(arena_t *a, void *bp, size_t asize, size_t align)
+{
+  size_t currSize = GET_SIZE(HDRP(bp));
+  size_t lead = (align - (uintptr_t)bp % align) % align;
+  int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+  while (lead != 0 && lead < MIN_BLOCK)
+    lead += align;
+
+  remove_free(a, bp);
+  if (lead != 0) {
+    PUT_TAGS(bp, lead, prev_alloc, 0);
+    insert_free(a, bp);
+    bp = NEXT_BLKP(bp);
+    currSize -= lead;
+    prev_alloc = 0;
+    STAT_ADD(a->st.splits, 1);
+  }
+
+  if ((currSize - asize) >= SPLIT_MIN) {
+    PUT_TAGS(bp, asize, prev_alloc, 1);
+    PUT_TAGS(NEXT_BLKP(bp), currSize - asize, 1, 0);
+    insert_free(a, NEXT_BLKP(bp));
+    STAT_ADD(a->st.splits, 1);
+  }
+  else {
+    PUT_TAGS(bp, currSize, prev_alloc, 1);
+    SET_PREV_ALLOC(NEXT_BLKP(bp), 1);
+  }
+  return bp;
+}
+
+//
+// alloc_aligned - Allocate a block of asize bytes whose payload is
+//                 align-aligned
+//
+static void *alloc_aligned(arena_t *a, size_t asize, size_t align)
+{
+  size_t need = asize + align + MIN_BLOCK;   /* worst case gap */
+  char *bp;
+
+  if ((bp = find_fit(a, need)) == NULL &&
+      (!quick_sweep(a) || (bp = find_fit(a, need)) == NULL) &&
+      (bp = extend_heap(a, MAX(need, CHUNKSIZE) / WSIZE)) == NULL)
+    return NULL;
+  return place_aligned(a, bp, asize, align);
+}
+
+#if USE_SLABS
+/////////////////////////////////////////////////////////////////////////////
+//
+// Slab pools
+//
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// slab_run_of - Return the run holding p, or NULL if p is a
+//               boundary-tag block
+//
+static inline slab_run_t *slab_run_of(void *p)
+{
+  uint32_t page = ((char *)p - heap_base) / PAGE_GRAIN;
+
+  if (!(page_map[page] & PAGE_SLAB))
+    return NULL;
+  return (slab_run_t *)(heap_base + page * PAGE_GRAIN);
+}
+
+static inline int slab_class(size_t size)
+{
+  return (size + DSIZE - 1) / DSIZE - 1;
+}
+
+//
+// slab_push/slab_unlink - Maintain the per-class list of partial runs
+//
+static void slab_push(arena_t *a, slab_run_t *run, int c)
+{
+  slab_run_t *head = OFF2PTR(a->slab_partial[c]);
+
+  run->next = a->slab_partial[c];
+  run->prev = 0;
+  if (head != NULL)
+    head->prev = PTR2OFF(run);
+  a->slab_partial[c] = PTR2OFF(run);
+}
+
+static void slab_unlink(arena_t *a, slab_run_t *run, int c)
+{
+  if (run->prev)
+    ((slab_run_t *)OFF2PTR(run->prev))->next = run->next;
+  else
+    a->slab_partial[c] = run->next;
+  if (run->next)
+    ((slab_run_t *)OFF2PTR(run->next))->prev = run->prev;
+}
+
+//
+// slab_new_run - Carve a fresh run for class c out of the heap
+//
+static slab_run_t *slab_new_run(arena_t *a, int c)
+{
+  slab_run_t *run;
+  uint32_t i, objsize = (c + 1) * DSIZE;
+
+  if ((run = alloc_aligned(a, SLAB_RUN_SIZE, SLAB_RUN_SIZE)) == NULL)
+    return NULL;
+
+  run->objsize = objsize;
+  run->nobjs = (SLAB_RUN_SIZE - ALLOC_OVERHEAD - SLAB_HDR_SIZE) / objsize;
+  run->nfree = run->nobjs;
+  run->hint = 0;
+  memset(run->freemap, 0, sizeof(run->freemap));
+  for (i = 0; i < run->nobjs; i++)
+    run->freemap[i / 64] |= (uint64_t)1 << (i % 64);
+
+  page_map[PTR2OFF(run) / PAGE_GRAIN] |= PAGE_SLAB;
+  slab_push(a, run, c);
+  return run;
+}
+
+//
+// slab_alloc - Allocate an object of at most SLAB_MAX bytes
+//
+static void *slab_alloc(arena_t *a, size_t size)
+{
+  int c = slab_class(size);
+  slab_run_t *run = OFF2PTR(a->slab_partial[c]);
+  uint32_t w, bit;
+
+  if (run == NULL && (run = slab_new_run(a, c)) == NULL)
+    return NULL;
+
+  for (w = run->hint; run->freemap[w] == 0; w++)
+    ;
+  bit = __builtin_ctzll(run->freemap[w]);
+  run->freemap[w] &= run->freemap[w] - 1;
+  run->hint = w;
+  if (--run->nfree == 0)
+    slab_unlink(a, run, c);
+
+  return (char *)run + SLAB_HDR_SIZE + (w * 64 + bit) * run->objsize;
+}
+
+//
+// slab_free - Return object p to its run.  A run that empties out
+//             goes back to the heap unless it is the only partial
+//             run of its class.
+//
+static void slab_free(arena_t *a, void *p)
+{
+  slab_run_t *run = slab_run_of(p);
+  int c = slab_class(run->objsize);
+  uint32_t i = ((char *)p - (char *)run - SLAB_HDR_SIZE) / run->objsize;
+
+  run->freemap[i / 64] |= (uint64_t)1 << (i % 64);
+  if (i / 64 < run->hint)
+    run->hint = i / 64;
+  if (run->nfree++ == 0)
+    slab_push(a, run, c);
+
+  if (run->nfree == run->nobjs &&
+      (run->prev != 0 || run->next != 0)) {
+    slab_unlink(a, run, c);
+    page_map[PTR2OFF(run) / PAGE_GRAIN] &= ~PAGE_SLAB;
+    arena_free(a, run);
+  }
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Mapped blocks
+//
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// map_len - Length of the mapping for a size-byte payload, or 0 if
+//           no mapping could be that large
+//
+static inline size_t map_len(size_t size)
+{
+  size_t page = mem_pagesize();
+
+  if (size > ~(size_t)0 - MAP_PAD - page)
+    return 0;
+  return (size + MAP_PAD + page - 1) & ~(page - 1);
+}
+
+//
+// MAP_SIZE - Length of the mapping that holds mapped block bp
+//
+static inline size_t MAP_SIZE(void *bp) {
+  return *(size_t *)((char *)bp - MAP_PAD);
+}
+
+//
+// map_alloc - Give a size-byte request a mapping of its own
+//
+// The length may not fit in a header word, so it is kept in a size_t
+// at the start of the mapping; the header only carries the m bit.
+//
+//  ------------------------------------------
+// |  len  ... | hdr(0:a:m) | payload ...     |
+//  ------------------------------------------
+//
+static void *map_alloc(size_t size)
+{
+  size_t len = map_len(size);
+  char *p;
+
+  if (len == 0 || (p = mem_map(len)) == (void *)-1)
+    return NULL;
+  *(size_t *)p = len;
+  PUT(p + MAP_PAD - WSIZE, PACK(0, 1, 1) | MAPPED);
+  return p + MAP_PAD;
+}
+
+static void map_free(void *bp)
+{
+  mem_unmap((char *)bp - MAP_PAD);
+}
+
+//
+// map_realloc - Resize mapped block bp for a size-byte payload,
+//               letting the kernel move it if it has to
+//
+static void *map_realloc(void *bp, size_t size)
+{
+  size_t len = map_len(size);
+  char *p;
+
+  if (len == MAP_SIZE(bp))
+    return bp;
+  if (len == 0 || (p = mem_remap((char *)bp - MAP_PAD, len)) == (void *)-1)
+    return NULL;
+  *(size_t *)p = len;
+  return p + MAP_PAD;
+}
+
+//
+// mm_memalign - Allocate a block of at least size bytes whose payload
+//               is a multiple of align, which must be a power of two
+//
+// The block comes from the heap whatever its size: the gap in front
+// of the aligned payload is split off as a free block, where a
+// mapping would have to waste it.
+//
+void *mm_memalign(size_t align, size_t size)
+{
+  arena_t *a;
+  void *bp;
+
+  if (align == 0 || (align & (align - 1)) != 0 || size == 0)
+    return NULL;
+  check_tick();
+  if (align <= DSIZE)
+    return malloc_block(size);    /* every payload is DSIZE aligned */
+  if (size > (~(size_t)0 >> 2) || align > (~(size_t)0 >> 2))
+    return NULL;
+
+  a = my_arena();
+  arena_lock(a);
+  bp = alloc_aligned(a, adjust_size(size), align);
+  arena_unlock(a);
+  return bp;
+}
+
+//
+// mm_calloc - Allocate a zeroed array of nmemb elements of size bytes
+//
+// Fresh mappings and heap memory that was never used before are
+// zero already (mem_sbrk_fresh), so only recycled blocks are cleared
+// in full.
+//
+void *mm_calloc(size_t nmemb, size_t size)
+{
+  arena_t *a;
+  void *bp;
+  size_t bytes;
+  int fresh = 0;
+
+  if (__builtin_mul_overflow(nmemb, size, &bytes) || bytes == 0)
+    return NULL;
+  check_tick();
+  if (bytes >= MMAP_THRESHOLD)
+    return map_alloc(bytes);
+
+#if MM_THREADS
+  int bin = tcache_bin(bytes);
+  if (bin >= 0 && (bp = tcache_get(bin)) != NULL) {
+    memset(bp, 0, bytes);
+    return bp;
+  }
+#endif
+
+  a = my_arena();
+  arena_lock(a);
+  bp = arena_malloc(a, bytes, &fresh);
+  arena_unlock(a);
+  if (bp == NULL)
+    return NULL;
+
+  if (!fresh)
+    memset(bp, 0, bytes);
+  else {
+    //
+    // While the new chunk sat on a free list it got list (or treap)
+    // links in its first words, and a footer that lands in our last
+    // word if place did not split it.
+    //
+    memset(bp, 0, bytes < 6 * WSIZE ? bytes : 6 * WSIZE);
+    if (ELIDE_FOOTERS)
+      PUT(FTRP(bp), 0);
+  }
+  return bp;
+}
+
+//
+// shrink_block - Trim allocated block bp down to asize bytes, returning
+//                the tail to the free lists if it is at least the
+//                minimum block size
+//
+static void shrink_block(arena_t *a, void *bp, size_t asize) {
+  size_t currSize = GET_SIZE(HDRP(bp));
+
+  if((currSize - asize) >= SPLIT_MIN){
+    PUT_TAGS(bp, asize, GET_PREV_ALLOC(HDRP(bp)), 1);
+    bp = NEXT_BLKP(bp);
+    PUT_TAGS(bp, currSize - asize, 1, 0);
+    coalesce(a, bp);
+    STAT_ADD(a->st.splits, 1);
+  }
+}
+
+//
+// grow_slot  - The growth chain slot of block bp in arena a
+// grow_chain - Return how many growths in a row resizing block bp of
+//              arena a (locked) to asize bytes makes, 0 if this is
+//              not a growth.  The caller notes the block again with
+//              grow_note once it has its new size and place.
+// grow_room  - Block size to give a request of asize bytes that ends
+//              a chain of grows growths
+// grow_age   - Advance arena a's (locked) growth clock and look at the
+//              next slot: a block that has not grown for GROW_AGE ticks
+//              is trimmed back to its last request and leaves the table
+// grow_forget - Drop the slot of block bp of arena a (locked), which is
+//              being freed; a slot only ever names a live block
+// grow_listed - Does block bp of arena a have a slot?  Safe without
+//              the lock: mm_free keeps such blocks out of the thread
+//              cache, where grow_age could not be allowed to trim them
+//
+// Slots are read without the lock by grow_listed, so off is stored
+// atomically, and grow_age clears it only once the trim is done.
+//
+static inline grow_t *grow_slot(arena_t *a, void *bp)
+{
+  uint32_t h = (uint32_t)(PTR2OFF(bp) / DSIZE) * 2654435761u;
+
+  return &a->grow[h >> (32 - GROW_LOG2)];
+}
+
+static uint32_t grow_chain(arena_t *a, void *bp, size_t asize)
+{
+  grow_t *g = grow_slot(a, bp);
+  size_t prev = GET_SIZE(HDRP(bp));
+  uint32_t grows = 0;
+
+  if (!GROW_HEADROOM)
+    return 0;
+  if (g->off == PTR2OFF(bp) && g->size == prev) {
+    prev = g->want;
+    grows = g->grows;
+    __atomic_store_n(&g->off, 0, __ATOMIC_RELAXED);
+  }
+  return asize > prev ? grows + 1 : 0;
+}
+
+static void grow_note(arena_t *a, void *bp, size_t asize, uint32_t grows)
+{
+  grow_t *g = grow_slot(a, bp);
+
+  g->size = GET_SIZE(HDRP(bp));
+  g->want = asize;
+  g->grows = grows;
+  g->stamp = a->grow_clock;
+  __atomic_store_n(&g->off, PTR2OFF(bp), __ATOMIC_RELAXED);
+}
+
+static inline size_t grow_room(size_t asize, uint32_t grows)
+{
+  if (grows < GROW_CHAIN)
+    return asize;
+  return asize + (asize / GROW_DIV & ~(size_t)(DSIZE - 1));
+}
+
+static inline void grow_age(arena_t *a)
+{
+  grow_t *g = &a->grow[a->grow_clock++ & (GROW_SLOTS - 1)];
+  void *bp;
+
+  if (!GROW_HEADROOM || g->off == 0 || a->grow_clock - g->stamp < GROW_AGE)
+    return;
+  bp = OFF2PTR(g->off);
+  if (GET_SIZE(HDRP(bp)) == g->size)
+    shrink_block(a, bp, g->want);
+  __atomic_store_n(&g->off, 0, __ATOMIC_RELEASE);
+}
+
+static inline void grow_forget(arena_t *a, void *bp)
+{
+  grow_t *g = grow_slot(a, bp);
+
+  if (GROW_HEADROOM && g->off == PTR2OFF(bp))
+    __atomic_store_n(&g->off, 0, __ATOMIC_RELAXED);
+}
+
+static inline int grow_listed(arena_t *a, void *bp)
+{
+  return GROW_HEADROOM &&
+         __atomic_load_n(&grow_slot(a, bp)->off, __ATOMIC_ACQUIRE) == PTR2OFF(bp);
+}
+
+//
+// realloc_in_place - Try to resize the block at ptr, owned by arena a
+//                    (locked), without moving it.  Returns 0 if the
+//                    caller must move the data; either way *grows is
+//                    the block's growth chain as grow_chain counts it.
+//
+static int realloc_in_place(arena_t *a, void *ptr, size_t size, uint32_t *grows)
+{
+  void *next, *end;
+  size_t asize, oldsize, avail, keep;
+
+  *grows = 0;
+  grow_age(a);
+#if USE_SLABS
+  slab_run_t *run = slab_run_of(ptr);
+  if (run != NULL)
+    return size <= run->objsize;
+#endif
+
+  asize = adjust_size(size);
+  oldsize = GET_SIZE(HDRP(ptr));
+  *grows = grow_chain(a, ptr, asize);
+  keep = grow_room(asize, *grows);
+  if (asize <= oldsize) {
+    // Within the headroom of a chain, or shrinking and ending one
+    shrink_block(a, ptr, MIN(keep, oldsize));
+    if (*grows != 0)
+      grow_note(a, ptr, asize, *grows);
+    return 1;
+  }
+
+  next = NEXT_BLKP(ptr);
+  avail = oldsize;
+  if (!GET_ALLOC(HDRP(next)))
+    avail += GET_SIZE(HDRP(next));
+  end = GET_ALLOC(HDRP(next)) ? next : NEXT_BLKP(next);
+
+  //
+  // At the end of the arena's newest chunk: grow the tail free block
+  // (or make one).  If the new memory turns out not to be adjacent,
+  // extend_heap starts a separate chunk and avail stays short.  The
+  // tail can always grow again in place, so it gets no headroom.
+  //
+  if (avail < asize && HDRP(end) == a->brk - WSIZE) {
+    if (extend_heap(a, MAX(asize - avail, MIN_BLOCK) / WSIZE) != NULL) {
+      next = NEXT_BLKP(ptr);
+      avail = oldsize;
+      if (!GET_ALLOC(HDRP(next)))
+        avail += GET_SIZE(HDRP(next));
+    }
+  }
+
+  if (avail < asize)
+    return 0;
+
+  remove_free(a, next);
+#if FIT_POLICY == FIT_NEXT
+  if (a->temp == next)
+    a->temp = ptr;
+#endif
+  PUT_TAGS(ptr, avail, GET_PREV_ALLOC(HDRP(ptr)), 1);
+  SET_PREV_ALLOC(NEXT_BLKP(ptr), 1);
+  check_merge(a, ptr, NEXT_BLKP(ptr));
+  //
+  // A block that now ends the arena's newest chunk also keeps a
+  // remainder of less than a page.  Split off, it is where the next
+  // small request lands, and the block has to move to grow again.
+  //
+  if (HDRP(NEXT_BLKP(ptr)) == a->brk - WSIZE && avail - MIN(keep, avail) < PAGE_GRAIN)
+    keep = avail;
+  shrink_block(a, ptr, MIN(keep, avail));
+  grow_note(a, ptr, asize, *grows);
+  return 1;
+}
+
+//
+// mm_realloc - Resize the block at ptr in place when possible
+//
+// Shrinking splits off the tail.  Growing absorbs a free successor,
+// first extending the heap if the block (or that successor) is the
+// last one before the epilogue.  Only when neither works do we fall
+// back to malloc, copy and free.  A block on a growth chain moves
+// into a block with headroom and stays on the chain.
+//
+void *mm_realloc(void *ptr, size_t size)
+{
+  void *newp;
+  arena_t *a;
+  size_t copySize;
+  uint32_t grows = 0;
+  int done;
+
+  if (ptr == NULL)
+    return mm_malloc(size);
+  if (size == 0) {
+    mm_free(ptr);
+    return NULL;
+  }
+  check_tick();
+
+  if (IS_MAPPED(ptr)) {
+    // Stay mapped while the size warrants it; otherwise move back
+    if (size >= MMAP_THRESHOLD && (newp = map_realloc(ptr, size)) != NULL) {
+      __atomic_fetch_add(&map_reallocs[newp != ptr], 1, __ATOMIC_RELAXED);
+      return newp;
+    }
+    __atomic_fetch_add(&map_reallocs[1], 1, __ATOMIC_RELAXED);
+    copySize = MAP_SIZE(ptr) - MAP_PAD;
+  }
+  else {
+    a = arena_of(ptr);
+    arena_lock(a);
+    done = realloc_in_place(a, ptr, size, &grows);
+#if USE_SLABS
+    slab_run_t *run = slab_run_of(ptr);
+    copySize = run != NULL ? run->objsize : GET_SIZE(HDRP(ptr)) - ALLOC_OVERHEAD;
+#else
+    copySize = GET_SIZE(HDRP(ptr)) - ALLOC_OVERHEAD;
+#endif
+    if (done)
+      STAT_ADD(a->st.realloc_in_place, 1);
+    else
+      STAT_ADD(a->st.realloc_copies, 1);
+    arena_unlock(a);
+    if (done)
+      return ptr;
+  }
+
+  newp = NULL;
+  if (grows >= GROW_CHAIN)
+    newp = malloc_block(grow_room(adjust_size(size), grows) - ALLOC_OVERHEAD);
+  if (newp == NULL)               /* the headroom is optional */
+    newp = malloc_block(size);
+  if (newp == NULL) {
+    printf("ERROR: mm_malloc failed in mm_realloc\n");
+    exit(1);
+  }
+  if (grows != 0 && !IS_MAPPED(newp)) {
+    a = arena_of(newp);
+    arena_lock(a);
+#if USE_SLABS
+    if (slab_run_of(newp) == NULL)
+#endif
+      grow_note(a, newp, adjust_size(size), grows);
+    arena_unlock(a);
+  }
+  if (size < copySize) {
+    copySize = size;
+  }
+  memcpy(newp, ptr, copySize);
+  free_block(ptr);
+  return newp;
+}
+
+//
+// largest_free - Size of the largest free block of arena a (locked),
+//                for remove_free to refresh a->st.largest_free when
+//                that block leaves
+//
+// The fit index finds it at the top of its size order: the right
+// spine of the treap or the highest exact bin, or the highest
+// non-empty list, which only holds blocks within a factor of two (an
+// eighth under TLSF) of each other.  The implicit-list engine would
+// have to walk the heap, so it reports the lower bound of the
+// highest occupied power-of-two class instead, and the counter is
+// only a lower bound there until a larger block is freed.
+//
+static size_t largest_free(arena_t *a)
+{
+  size_t best = 0;
+#if FIT_POLICY == FIT_NEXT
+  int c;
+
+  for (c = MM_STATS_CLASSES - 1; c >= 0; c--)
+    if (a->st.free_blocks[c] != 0)
+      return (size_t)1 << c;
+#elif FIT_POLICY == FIT_TREE
+  void *t = OFF2PTR(a->tree_root);
+
+  if (t != NULL) {
+    while (RIGHT(t) != NULL)
+      t = RIGHT(t);
+    return GET_SIZE(HDRP(t));
+  }
+  if (a->bin_map != 0)
+    return (size_t)(LOG2(a->bin_map) + 2) * DSIZE;
+#else
+  int c;
+  void *bp;
+
+#if FIT_POLICY == FIT_TLSF
+  if (a->fl_bitmap == 0)
+    return 0;
+  c = LOG2(a->fl_bitmap);
+  c = c * SL_COUNT + LOG2(a->sl_bitmap[c]);
+#else
+  for (c = NUM_CLASSES - 1; c > 0 && a->free_lists[c] == 0; c--)
+    ;
+#endif
+  for (bp = OFF2PTR(a->free_lists[c]); bp != NULL; bp = NEXT_FREE(bp))
+    best = MAX(best, GET_SIZE(HDRP(bp)));
+#endif
+  return best;
+}
+
+//
+// mm_stats - Fill in *st with the allocator's counters
+//
+// Each arena keeps its counters as it goes, under its own lock, so a
+// read only sums them: it never walks the heap, and it takes no lock.
+// An arena busy meanwhile may show counters a step apart.  Blocks in
+// thread caches, quick lists and slab runs count as live.
+//
+void mm_stats(struct mm_stats *st)
+{
+  int i, c;
+
+  memset(st, 0, sizeof(*st));
+  for (i = 0; i < MM_ARENAS; i++) {
+    arena_t *a = &arenas[i];
+    size_t block_bytes = STAT_GET(a->block_bytes);
+    size_t free_bytes = STAT_GET(a->st.free_bytes);
+
+    st->live_bytes += block_bytes - MIN(free_bytes, block_bytes);
+    st->free_bytes += free_bytes;
+    st->largest_free = MAX(st->largest_free, STAT_GET(a->st.largest_free));
+    for (c = 0; c < MM_STATS_CLASSES; c++)
+      st->free_blocks[c] += STAT_GET(a->st.free_blocks[c]);
+    st->extends += STAT_GET(a->st.extends);
+    st->splits += STAT_GET(a->st.splits);
+    st->coalesces += STAT_GET(a->st.coalesces);
+    st->realloc_in_place += STAT_GET(a->st.realloc_in_place);
+    st->realloc_copies += STAT_GET(a->st.realloc_copies);
+  }
+  st->realloc_in_place += __atomic_load_n(&map_reallocs[0], __ATOMIC_RELAXED);
+  st->realloc_copies += __atomic_load_n(&map_reallocs[1], __ATOMIC_RELAXED);
+  st->mapped_bytes = mem_mapsize();
+  st->heap_size = mem_heapsize();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Heap snapshots
+//
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// A snapshot file starts with an mm_image_t and the page map up to
+// page_hi, followed, from the next page on, by memlib's image of the
+// heap and of the huge blocks' mappings (see mem_save).  Only a
+// build with the same layout can restore it.
+//
+#define MM_IMAGE_MAGIC   0x316567616d696d6dULL   /* "mmimage1" */
+#define MM_IMAGE_CONFIG  (WIDE_HEADERS | ELIDE_FOOTERS << 1 | USE_SLABS << 2 | \
+                          DEFER_COALESCE << 3 | MM_THREADS << 4 |             \
+                          LIST_ORDER << 5 | FIT_POLICY << 6)
+
+typedef struct {
+  uint64_t magic;
+  uint32_t config;                    /* MM_IMAGE_CONFIG of the writer */
+  uint32_t page_hi;                   /* bytes of page map that follow */
+  size_t image_size;                  /* sizeof(mm_image_t) of the writer */
+  char *heap_base;
+  size_t heap_span;
+  uint64_t map_reallocs[2];
+  arena_t arenas[MM_ARENAS];          /* locks excepted */
+} mm_image_t;
+
+static mm_image_t image;
+
+static inline off_t image_heap_off(uint32_t page_hi)
+{
+  size_t page = mem_pagesize();
+
+  return (sizeof(mm_image_t) + page_hi + page - 1) & ~(page - 1);
+}
+
+//
+// mm_snapshot - Write the heap and the allocator's state to path
+//
+// The heap is position independent apart from the arenas' pointers
+// into it, so the image is the heap as it stands, plus the arenas
+// and the page map.  The calling thread's cache is flushed first;
+// blocks in other threads' caches stay allocated in the image.
+// Not thread safe: no other thread may be inside the allocator.
+// Returns 0, or -1 with errno set.
+//
+int mm_snapshot(const char *path)
+{
+  FILE *fp;
+  int err = 0;
+
+#if MM_THREADS
+  tcache_flush(NULL);
+#endif
+  image.magic = MM_IMAGE_MAGIC;
+  image.config = MM_IMAGE_CONFIG;
+  image.page_hi = page_hi;
+  image.image_size = sizeof(mm_image_t);
+  image.heap_base = heap_base;
+  image.heap_span = heap_span;
+  image.map_reallocs[0] = map_reallocs[0];
+  image.map_reallocs[1] = map_reallocs[1];
+  memcpy(image.arenas, arenas, sizeof(arenas));
+
+  if ((fp = fopen(path, "w")) == NULL)
+    return -1;
+  if (fwrite(&image, sizeof(image), 1, fp) != 1 ||
+      fwrite(page_map, 1, page_hi, fp) != page_hi || fflush(fp) != 0 ||
+      mem_save(fileno(fp), image_heap_off(page_hi)) != 0)
+    err = errno;
+  if (fclose(fp) != 0 && err == 0)
+    err = errno;
+  errno = err;
+  return err ? -1 : 0;
+}
+
+//
+// mm_restore - Replace the heap with the snapshot in path
+//
+// In place of mm_init: memlib maps the heap back from the file at
+// the address it was taken from, and the arenas and page map are
+// read back around it, so every block the snapshot held is where it
+// was.  The file must stay in place while the heap is in use.  Not
+// thread safe.  Returns -1 with errno set if the file is not a
+// snapshot of this build or its addresses are taken, leaving an
+// empty heap as mm_init would.
+//
+int mm_restore(const char *path)
+{
+  FILE *fp;
+  pthread_mutex_t lock;
+  int i, err;
+
+#if MM_THREADS
+  pthread_once(&mm_once, mm_once_init);
+#endif
+  if ((fp = fopen(path, "r")) == NULL)
+    return -1;
+  if (fread(&image, sizeof(image), 1, fp) != 1 ||
+      image.magic != MM_IMAGE_MAGIC || image.config != MM_IMAGE_CONFIG ||
+      image.image_size != sizeof(mm_image_t)) {
+    fclose(fp);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (mem_load(fileno(fp), image_heap_off(image.page_hi)) != 0)
+    goto fail;
+  if (mem_heap_lo() != image.heap_base || mem_max_heap() != image.heap_span) {
+    errno = EINVAL;
+    goto fail;
+  }
+  heap_base = mem_heap_lo();
+  memset(page_map, 0, page_hi);
+  if (page_map_init() != 0 ||
+      fread(page_map, 1, image.page_hi, fp) != image.page_hi) {
+    errno = EINVAL;
+    goto fail;
+  }
+  fclose(fp);
+
+  page_hi = image.page_hi;
+  map_reallocs[0] = image.map_reallocs[0];
+  map_reallocs[1] = image.map_reallocs[1];
+  for (i = 0; i < MM_ARENAS; i++) {
+    lock = arenas[i].lock;
+    arenas[i] = image.arenas[i];
+    arenas[i].lock = lock;
+  }
+  mm_gen++;                           /* this process's caches are stale */
+  return 0;
+
+ fail:
+  err = errno;
+  fclose(fp);
+  mem_reset_brk();
+  mm_init();
+  errno = err;
+  return -1;
+}
+
+//
+// mm_checkheap - Check the heap for consistency
+//
+// Walks every chunk of the heap in address order, then each arena's
+// free lists and slab runs, and holds the mm_stats counters to what
+// the walk saw.  Not thread safe; blocks sitting in thread caches
+// are counted as allocated.
+//
+void mm_checkheap(int verbose)
+{
+  char *chunk, *heap_listp;
+  void *bp;
+  int i, c;
+#if FIT_POLICY != FIT_NEXT
+  int nfree = 0, nlisted = 0;   /* free blocks in the heap, on the lists */
+#endif
+  size_t block_bytes[MM_ARENAS] = {0}, free_bytes[MM_ARENAS] = {0};
+  size_t largest[MM_ARENAS] = {0};
+  size_t free_blocks[MM_ARENAS][MM_STATS_CLASSES];
+
+  memset(free_blocks, 0, sizeof(free_blocks));
+
+  if (verbose) {
+    printf("Heap (%p):\n", heap_base);
+  }
+
+  for (chunk = heap_base; chunk < (char *)mem_heap_hi(); chunk = PAGE_ROUND(bp)) {
+    heap_listp = chunk + (2 * WSIZE);
+
+    if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp))) {
+      printf("Bad prologue header\n");
+      return;
+    }
+    checkblock(heap_listp);
+
+    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+      if (verbose)  {
+        printblock(bp);
+      }
+      checkblock(bp);
+      if (GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))) != GET_ALLOC(HDRP(bp)))
+        printf("Error: prev-alloc bit after %p is stale\n", bp);
+      if (arena_of(bp) != arena_of(heap_listp))
+        printf("Error: block %p crosses into another arena's pages\n", bp);
+      i = arena_of(heap_listp)->id;
+      if (bp != heap_listp)
+        block_bytes[i] += GET_SIZE(HDRP(bp));
+      if (!GET_ALLOC(HDRP(bp))) {
+#if FIT_POLICY != FIT_NEXT
+        nfree++;
+#endif
+        free_bytes[i] += GET_SIZE(HDRP(bp));
+        free_blocks[i][LOG2(GET_SIZE(HDRP(bp)))]++;
+        largest[i] = MAX(largest[i], GET_SIZE(HDRP(bp)));
+        if (!GET_ALLOC(HDRP(NEXT_BLKP(bp))))
+          printf("Error: %p and its successor escaped coalescing\n", bp);
+      }
+    }
+
+    if (verbose) {
+      printblock(bp);
+    }
+
+    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp)))) {
+      printf("Bad epilogue header\n");
+    }
+  }
+
+  for (i = 0; i < MM_ARENAS; i++) {
+#if FIT_POLICY != FIT_NEXT
+    checkfreelists(&arenas[i], &nlisted);
+#endif
+#if USE_SLABS
+    checkslabs(&arenas[i]);
+#endif
+#if DEFER_COALESCE
+    checkquick(&arenas[i]);
+#endif
+    if (arenas[i].block_bytes != block_bytes[i])
+      printf("Error: arena %d counts %zu block bytes, the heap has %zu\n",
+             i, arenas[i].block_bytes, block_bytes[i]);
+    if (arenas[i].st.free_bytes != free_bytes[i])
+      printf("Error: arena %d counts %zu free bytes, the heap has %zu\n",
+             i, arenas[i].st.free_bytes, free_bytes[i]);
+    for (c = 0; c < MM_STATS_CLASSES; c++)
+      if (arenas[i].st.free_blocks[c] != free_blocks[i][c])
+        printf("Error: arena %d counts %zu free blocks in class %d, the heap has %zu\n",
+               i, arenas[i].st.free_blocks[c], c, free_blocks[i][c]);
+#if FIT_POLICY != FIT_NEXT
+    if (arenas[i].st.largest_free != largest[i])
+      printf("Error: arena %d's largest free block is %zu bytes, not %zu\n",
+             i, largest[i], arenas[i].st.largest_free);
+#endif
+  }
+#if FIT_POLICY != FIT_NEXT
+  if (nlisted != nfree)
+    printf("Error: %d free blocks but %d on free lists\n", nfree, nlisted);
+#endif
+}
+
+//
+// mm_check_every - Take a step of mm_check_step every ops requests
+//                  (malloc, free or realloc) of each thread, checking
+//                  nblocks blocks; ops 0 turns it off
+//
+void mm_check_every(unsigned ops, unsigned nblocks)
+{
+  check_blocks = nblocks;
+  check_every = ops;
+}
+
+//
+// mm_check_step - Check the next nblocks blocks of one arena
+//
+// Each call takes the arenas in turn and picks up where the last
+// check of that arena stopped, following the arena's chunk chain and
+// starting over at its first chunk, so every block is looked at
+// once per lap.  A block is held to what mm_checkheap holds it to,
+// as far as its neighbours go: sane size and tags, the next block's
+// prev-alloc bit, the arena owning it, no free successor, and free
+// list or treap links that point back at it.  The totals are left
+// to mm_checkheap.  Takes the arena's lock, so it is safe to call
+// at any time.  Prints what it finds and returns the error count.
+//
+int mm_check_step(int nblocks)
+{
+  arena_t *a = NULL;
+  char *bp, *hi;
+  size_t size;
+  int i, errors = 0;
+
+  for (i = 0; i < MM_ARENAS && a == NULL; i++) {
+    a = &arenas[__atomic_fetch_add(&check_arena, 1, __ATOMIC_RELAXED) % MM_ARENAS];
+    if (a->heap_listp == NULL)
+      a = NULL;
+  }
+  if (a == NULL)
+    return 0;
+
+  arena_lock(a);
+  hi = (char *)mem_heap_hi() + 1;
+  if (a->check_cursor == NULL) {
+    a->check_chunk = a->heap_listp - (2 * WSIZE);
+    a->check_cursor = a->heap_listp;
+  }
+  for (bp = a->check_cursor; nblocks > 0; nblocks--) {
+    size = GET_SIZE(HDRP(bp));
+    if (size == 0) {
+      /* the epilogue: on to the arena's next chunk, or back to its first */
+      if (!GET_ALLOC(HDRP(bp))) {
+        printf("Error: epilogue %p is not allocated\n", bp);
+        errors++;
+      }
+      bp = OFF2PTR(GET(a->check_chunk));
+      a->check_chunk = bp ? bp : a->heap_listp - (2 * WSIZE);
+      bp = a->check_chunk + (2 * WSIZE);
+      continue;
+    }
+    if (size % DSIZE || size < DSIZE || bp + size > hi) {
+      printf("Error: block %p has size %zu\n", bp, size);
+      errors++;
+      bp = NULL;                        /* no way on; start the lap again */
+      break;
+    }
+    errors += checkblock(bp);
+    if (GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))) != GET_ALLOC(HDRP(bp))) {
+      printf("Error: prev-alloc bit after %p is stale\n", bp);
+      errors++;
+    }
+    if (arena_of(bp) != a) {
+      printf("Error: block %p crosses into another arena's pages\n", bp);
+      errors++;
+    }
+    if (!GET_ALLOC(HDRP(bp))) {
+      if (!GET_ALLOC(HDRP(NEXT_BLKP(bp)))) {
+        printf("Error: %p and its successor escaped coalescing\n", bp);
+        errors++;
+      }
+#if FIT_POLICY != FIT_NEXT
+      errors += checklinks(a, bp);
+#endif
+    }
+    bp = NEXT_BLKP(bp);
+  }
+  a->check_cursor = bp;
+  arena_unlock(a);
+  return errors;
+}
+
+#if FIT_POLICY != FIT_NEXT
+//
+// checklinks - Free block bp of arena a must be where its links say:
+// its neighbours on its list point back at it, and the first block
+// of a list is the list's head.  In the treap the first block of a
+// node's list is the node, which its parent (or the root) points at.
+//
+static int checklinks(arena_t *a, void *bp)
+{
+  char *hi = mem_heap_hi();
+  void *next = NEXT_FREE(bp), *prev = PREV_FREE(bp);
+
+  if ((next != NULL && ((char *)next < heap_base || (char *)next > hi)) ||
+      (prev != NULL && ((char *)prev < heap_base || (char *)prev > hi))) {
+    printf("Error: free block %p links outside the heap\n", bp);
+    return 1;
+  }
+  if (next != NULL && PREV_FREE(next) != bp) {
+    printf("Error: broken prev link after %p\n", bp);
+    return 1;
+  }
+  if (prev != NULL) {
+    if (NEXT_FREE(prev) != bp) {
+      printf("Error: broken next link before %p\n", bp);
+      return 1;
+    }
+    return 0;
+  }
+#if FIT_POLICY == FIT_TREE
+  if (GET_SIZE(HDRP(bp)) > TREE_MIN) {
+    void *parent = PARENT(bp);
+
+    if (parent == NULL ? OFF2PTR(a->tree_root) != bp :
+        (char *)parent < heap_base || (char *)parent > hi ||
+        (LEFT(parent) != bp && RIGHT(parent) != bp)) {
+      printf("Error: treap node %p is not linked from its parent\n", bp);
+      return 1;
+    }
+    return 0;
+  }
+#endif
+  if (OFF2PTR(a->free_lists[size_class(GET_SIZE(HDRP(bp)))]) != bp) {
+    printf("Error: free block %p is on no free list\n", bp);
+    return 1;
+  }
+  return 0;
+}
+
+//
+// checkfreelists - Every block listed in arena a must be free, owned
+// by a, in the right class, and doubly linked.  Adds the number of
+// listed blocks to *nlisted.
+//
+static void checkfreelists(arena_t *a, int *nlisted)
+{
+  int c;
+  void *bp;
+
+  for (c = 0; c < NUM_CLASSES; c++) {
+    for (bp = OFF2PTR(a->free_lists[c]); bp != NULL; bp = NEXT_FREE(bp)) {
+      (*nlisted)++;
+      if ((char *)bp < heap_base || (char *)bp > (char *)mem_heap_hi()) {
+        printf("Error: free list %d points outside the heap (%p)\n", c, bp);
+        break;
+      }
+      if (GET_ALLOC(HDRP(bp)))
+        printf("Error: allocated block %p is on free list %d\n", bp, c);
+      if (arena_of(bp) != a)
+        printf("Error: block %p is on a free list of arena %d\n", bp, a->id);
+      if (size_class(GET_SIZE(HDRP(bp))) != c)
+        printf("Error: block %p is on the wrong free list (%d)\n", bp, c);
+      if (NEXT_FREE(bp) != NULL && PREV_FREE(NEXT_FREE(bp)) != bp)
+        printf("Error: broken prev link after %p\n", bp);
+    }
+#if FIT_POLICY == FIT_TLSF
+    if (!(a->sl_bitmap[c / SL_COUNT] & (1u << (c % SL_COUNT))) != !a->free_lists[c])
+      printf("Error: second-level bitmap disagrees with list %d\n", c);
+    if (!(a->fl_bitmap & ((word_t)1 << (c / SL_COUNT))) != !a->sl_bitmap[c / SL_COUNT])
+      printf("Error: first-level bitmap disagrees with list %d\n", c);
+#elif FIT_POLICY == FIT_TREE
+    if (!(a->bin_map & ((uint64_t)1 << c)) != !a->free_lists[c])
+      printf("Error: bin bitmap disagrees with bin %d\n", c);
+#endif
+  }
+#if FIT_POLICY == FIT_TREE
+  if (a->tree_root != 0 && PARENT(OFF2PTR(a->tree_root)) != NULL)
+    printf("Error: treap root of arena %d has a parent\n", a->id);
+  checktree(a, OFF2PTR(a->tree_root), TREE_MIN, ~(size_t)0, nlisted);
+#endif
+}
+#endif
+
+#if FIT_POLICY == FIT_TREE
+//
+// checktree - Check the subtree at t: sizes strictly between lo and
+// hi, children pointing back at their parent, priorities no higher
+// than the parent's, and each node's list holding free blocks of the
+// node's size.  Adds every block seen to *nlisted.
+//
+static void checktree(arena_t *a, void *t, size_t lo, size_t hi, int *nlisted)
+{
+  void *bp, *child;
+  size_t size;
+  int side;
+
+  if (t == NULL)
+    return;
+  size = GET_SIZE(HDRP(t));
+  if (size <= lo || size >= hi)
+    printf("Error: treap node %p of size %zu is out of order\n", t, size);
+  if (PREV_FREE(t) != NULL)
+    printf("Error: treap node %p has a prev link\n", t);
+
+  for (bp = t; bp != NULL; bp = NEXT_FREE(bp)) {
+    (*nlisted)++;
+    if (GET_ALLOC(HDRP(bp)))
+      printf("Error: allocated block %p is in the treap\n", bp);
+    if (arena_of(bp) != a)
+      printf("Error: block %p is in the treap of arena %d\n", bp, a->id);
+    if (GET_SIZE(HDRP(bp)) != size)
+      printf("Error: block %p is on the list of a %zu-byte node\n", bp, size);
+    if (NEXT_FREE(bp) != NULL && PREV_FREE(NEXT_FREE(bp)) != bp)
+      printf("Error: broken prev link after %p\n", bp);
+  }
+
+  for (side = 0; side < 2; side++) {
+    child = side ? RIGHT(t) : LEFT(t);
+    if (child == NULL)
+      continue;
+    if (PARENT(child) != t)
+      printf("Error: treap child %p does not point back at %p\n", child, t);
+    if (GET(PRIOP(child)) > GET(PRIOP(t)))
+      printf("Error: treap child %p outranks its parent %p\n", child, t);
+    checktree(a, child, side ? size : lo, side ? hi : size, nlisted);
+  }
+}
+#endif
+
+static void printblock(void *bp)
+{
+  size_t hsize, halloc, fsize, falloc;
+
+  hsize = GET_SIZE(HDRP(bp));
+  halloc = GET_ALLOC(HDRP(bp));
+
+  if (hsize == 0) {
+    printf("%p: EOL\n", bp);
+    return;
+  }
+
+  if (ELIDE_FOOTERS && halloc) {
+    printf("%p: header: [%zu:%c%s]\n",
+	   bp,
+	   hsize, (halloc ? 'a' : 'f'),
+	   GET_PREV_ALLOC(HDRP(bp)) ? "" : " prev f");
+    return;
+  }
+
+  fsize = GET_SIZE(FTRP(bp));
+  falloc = GET_ALLOC(FTRP(bp));
+  printf("%p: header: [%zu:%c%s] footer: [%zu:%c]\n",
+	 bp,
+	 hsize, (halloc ? 'a' : 'f'),
+	 GET_PREV_ALLOC(HDRP(bp)) ? "" : " prev f",
+	 fsize, (falloc ? 'a' : 'f'));
+}
+
+static int checkblock(void *bp)
+{
+  int errors = 0;
+
+  if ((uintptr_t)bp % DSIZE) {
+    printf("Error: %p is not doubleword aligned\n", bp);
+    errors++;
+  }
+  //
+  // The footer's prev-alloc bit is not kept up to date, so only the
+  // size and allocated fields have to agree.
+  //
+  if ((!ELIDE_FOOTERS || !GET_ALLOC(HDRP(bp))) &&
+      ((GET(HDRP(bp)) & ~0x2) != (GET(FTRP(bp)) & ~0x2))) {
+    printf("Error: header does not match footer\n");
+    errors++;
+  }
+  return errors;
+}
+
+#if DEFER_COALESCE
+//
+// checkquick - Every block on a quick list of arena a must be an
+//              allocated block of the list's size, owned by a
+//
+static void checkquick(arena_t *a)
+{
+  uint32_t n = 0;
+  void *bp;
+  int c;
+
+  for (c = 0; c < QUICK_BINS; c++)
+    for (bp = a->quick[c]; bp != NULL; bp = *(void **)bp, n++) {
+      if (!GET_ALLOC(HDRP(bp)) || GET_SIZE(HDRP(bp)) != (size_t)c * DSIZE)
+        printf("Error: quick block %p is not an allocated block of %d bytes\n",
+               bp, c * DSIZE);
+      if (arena_of(bp) != a)
+        printf("Error: quick block %p is on the lists of another arena\n", bp);
+    }
+  if (n != a->nquick)
+    printf("Error: arena %d has %u quick blocks but counts %u\n", a->id, n, a->nquick);
+}
+#endif
+
+#if USE_SLABS
+//
+// checkslabs - Partial runs of arena a must be marked in the page
+// map and their free counts must agree with their bitmaps
+//
+static void checkslabs(arena_t *a)
+{
+  int c, w, nbits;
+  slab_run_t *run;
+
+  for (c = 0; c < SLAB_CLASSES; c++) {
+    for (run = OFF2PTR(a->slab_partial[c]); run != NULL; run = OFF2PTR(run->next)) {
+      if (slab_run_of(run) != run)
+        printf("Error: partial run %p is not in the page map\n", run);
+      if (arena_of(run) != a)
+        printf("Error: run %p is on a slab list of arena %d\n", run, a->id);
+      if (slab_class(run->objsize) != c)
+        printf("Error: run %p of size %d is on slab list %d\n",
+               run, run->objsize, c);
+      if (GET_SIZE(HDRP(run)) < SLAB_RUN_SIZE || !GET_ALLOC(HDRP(run)))
+        printf("Error: run %p is not an allocated heap block\n", run);
+      for (nbits = 0, w = 0; w < SLAB_MAP_WORDS; w++)
+        nbits += __builtin_popcountll(run->freemap[w]);
+      if (nbits != run->nfree || run->nfree == 0)
+        printf("Error: run %p has %d free bits but nfree %d\n",
+               run, nbits, run->nfree);
+    }
+  }
+}
+#endif
@@ -1,10 +1,56 @@
+#ifndef __MM_H_
+#define __MM_H_
+
 #include <stdio.h>
 #include <stdint.h>
 
 extern int mm_init (void);
-extern void *mm_malloc (uint32_t size);
+extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
-extern void *mm_realloc(void *ptr, uint32_t size);
+extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_memalign(size_t align, size_t size);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **ptrs);
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/*
+ * Allocator counters, as filled in by mm_stats.  Byte counts are of
+ * whole blocks, headers included; free_blocks[c] counts the free
+ * heap blocks of 2^c to 2^(c+1)-1 bytes.
+ */
+#define MM_STATS_CLASSES 64
+
+struct mm_stats {
+    size_t heap_size;        /* mem_heapsize(): bytes below the break */
+    size_t mapped_bytes;     /* bytes of blocks with a mapping of their own */
+    size_t live_bytes;       /* allocated heap blocks, cached ones included */
+    size_t free_bytes;       /* free heap blocks */
+    size_t largest_free;     /* size of the largest free heap block */
+    size_t free_blocks[MM_STATS_CLASSES];
+    uint64_t extends;        /* times extend_heap grew the heap */
+    uint64_t splits;         /* blocks cut in two */
+    uint64_t coalesces;      /* free neighbours merged */
+    uint64_t realloc_in_place;  /* reallocs that kept their pointer */
+    uint64_t realloc_copies;    /* reallocs that moved the data */
+};
+
+extern void mm_stats(struct mm_stats *st);
+
+/*
+ * Heap snapshots: mm_snapshot writes the heap to a file, and
+ * mm_restore, called in place of mm_init, reads it back to the same
+ * address.  Both return 0, or -1 with errno set.
+ */
+extern int mm_snapshot(const char *path);
+extern int mm_restore(const char *path);
+
+/*
+ * Incremental checking: mm_check_step checks the next nblocks blocks
+ * of one arena and returns the number of errors it printed, and
+ * mm_check_every has every ops-th request of a thread take a step.
+ */
+extern int mm_check_step(int nblocks);
+extern void mm_check_every(unsigned ops, unsigned nblocks);
 
 
 /* 
@@ -22,3 +68,4 @@ typedef struct {
 
 extern team_t team;
 
+#endif /* __MM_H_ */
@@ -0,0 +1,40 @@
+/*
+ * mmbackend.c - mm.c as an mdriver backend (see backend.h)
+ *
+ * Linked with mm.c and memlib.c into mm.so, which carries its own
+ * copy of the simulated heap: nothing but mm_backend is exported, so
+ * several builds of mm.c with different MMFLAGS can be loaded into
+ * one mdriver next to the one it was linked with.
+ */
+#include <stdio.h>
+
+#include "backend.h"
+#include "memlib.h"
+
+/*
+ * mmb_init - Reset the simulated heap and the allocator, as mdriver
+ *     does before each replay of its own mm.c
+ */
+static int mmb_init(void)
+{
+	static int mem_ready = 0;
+
+	if (!mem_ready)
+	{
+		mem_init();
+		mem_ready = 1;
+	}
+	mem_reset_brk();
+	return mm_init();
+}
+
+__attribute__((visibility("default"))) const mm_backend_t mm_backend = {
+	.abi = MM_BACKEND_ABI,
+	.init = mmb_init,
+	.malloc = mm_malloc,
+	.free = mm_free,
+	.realloc = mm_realloc,
+	.calloc = mm_calloc,
+	.memalign = mm_memalign,
+	.stats = mm_stats,
+};
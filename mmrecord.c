@@ -0,0 +1,736 @@
+/*
+ * mmrecord.c - Record a program's allocations as an mdriver trace
+ *
+ * usage: LD_PRELOAD=./mmrecord.so MMRECORD_FILE=out.bin program ...
+ *
+ * Interposes malloc, calloc, realloc, free and the aligned allocators,
+ * gives every live pointer a dense block id (ids are reused once
+ * freed), and streams the requests to MMRECORD_FILE (default
+ * mmrecord.<pid>.bin) in the binary trace format of trace.h. With
+ * MMRECORD_TEXT=1 set, the text .rep format is written instead.
+ * The header is filled in when the program exits.
+ *
+ * Each thread appends its requests, stamped with a number from one
+ * atomic counter, to a buffer of its own under a lock that only a
+ * flush contends for. When a buffer fills, or at exit, the flush locks
+ * every buffer, merges them in stamp order, gives the pointers their
+ * ids and writes the requests out with write(2). The recorder itself
+ * never calls malloc: its id table and buffers live in static memory
+ * or in mmap'd pages.
+ *
+ * Frees are stamped before the memory is released and allocations
+ * after they return, so that a block reused by another thread can't
+ * appear in the trace before it was freed. A realloc is stamped twice,
+ * before the call for the block it may release and after it for the
+ * block it returns, and takes its place in the trace at the second.
+ * Memory allocated before the recorder started, or by a forked child,
+ * isn't in the table, and frees of it are left out of the trace.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+
+#define BUF_OPS 65536		  /* requests buffered between writes */
+#define THREAD_OPS 4096		  /* requests a thread buffers between drains */
+#define TABLE_MIN 65536		  /* initial slots in the id table */
+#define BOOT_SIZE (64 << 10)  /* memory for calls made by dlsym */
+#define TEXT_HDR "%11d\n%11d\n%11d\n%11d\n" /* fixed width, rewritten at exit */
+
+/* The real allocator */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+
+/* Memory handed out while dlsym is looking up the real allocator */
+static char boot[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t boot_used;
+static int booting;
+
+/*
+ * Live pointers and their ids, in an open-addressed table with linear
+ * probing. A slot with ptr 0 is empty.
+ */
+typedef struct
+{
+	uintptr_t ptr;
+	int32_t id;
+} slot_t;
+
+/*
+ * A request as a thread buffers it, before it has ids. Besides the
+ * trace's request types, the two halves of a realloc that has not
+ * returned yet, or failed, are events of their own.
+ */
+#define MOVE_FROM (-1) /* realloc is about to release ptr... */
+#define MOVE_BACK (-2) /* ... but failed, and ptr stays */
+
+typedef struct
+{
+	uint64_t stamp; /* order among all threads' events */
+	uintptr_t ptr;
+	size_t size;
+	size_t align;
+	int type; /* a RequestType, MOVE_FROM or MOVE_BACK */
+} event_t;
+
+/* A thread's buffer; it outlives the thread and goes to a later one */
+typedef struct tbuf
+{
+	pthread_mutex_t lock; /* the thread's own, and the flush's */
+	struct tbuf *next;	  /* in the list of all buffers */
+	int in_use;			  /* a live thread owns it */
+	int n;				  /* events buffered... */
+	int head;			  /* ... and, in drain, the first not merged */
+	int32_t moving;		  /* id a realloc in flight released, or -1 */
+	event_t ev[THREAD_OPS];
+} tbuf_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* the flush */
+static tbuf_t *tbufs;			 /* all buffers; pushed under lock */
+static uint64_t stamp;			 /* next event's stamp */
+static pthread_key_t tbuf_key;	 /* releases a buffer at thread exit */
+static __thread tbuf_t *mine __attribute__((tls_model("initial-exec")));
+static int fd = -1;				 /* the trace file, or -1 if not recording */
+static int text;				 /* write the .rep format? */
+static slot_t *table;			 /* pointer -> id... */
+static size_t table_size;		 /* ... with this many slots, a power of 2 */
+static size_t table_used;
+static int32_t *free_ids;		 /* ids ready for reuse... */
+static size_t free_ids_size;	 /* ... room for this many */
+static size_t nfree_ids;
+static int32_t next_id;			 /* ids below this have been used */
+static int64_t num_ops;			 /* requests recorded */
+static traceop_t buf[BUF_OPS];	 /* requests not yet written */
+static int nbuf;
+static tracehdr_t hdr;
+
+static void record_init(void);
+
+/*
+ * get_pages - mmap anonymous memory for the recorder's own tables
+ */
+static void *get_pages(size_t len)
+{
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return (p == MAP_FAILED) ? NULL : p;
+}
+
+/*
+ * hash - Spread the bits of an aligned pointer over the table
+ */
+static inline size_t hash(uintptr_t p)
+{
+	return (size_t)((p >> 4) * 0x9E3779B97F4A7C15ULL) & (table_size - 1);
+}
+
+/*
+ * table_grow - Double the id table, or create it. Returns 0 if there is
+ *     no memory, in which case recording stops.
+ */
+static int table_grow(void)
+{
+	size_t old_size = table_size, i, j;
+	slot_t *old = table;
+
+	table_size = old_size ? 2 * old_size : TABLE_MIN;
+	if ((table = get_pages(table_size * sizeof(slot_t))) == NULL)
+		return 0;
+	for (i = 0; i < old_size; i++)
+		if (old[i].ptr != 0)
+		{
+			for (j = hash(old[i].ptr); table[j].ptr != 0; j = (j + 1) & (table_size - 1))
+				;
+			table[j] = old[i];
+		}
+	if (old != NULL)
+		munmap(old, old_size * sizeof(slot_t));
+	return 1;
+}
+
+/*
+ * table_insert - Add pointer p, which must not be there, with id
+ */
+static void table_insert(uintptr_t p, int32_t id)
+{
+	size_t i;
+
+	for (i = hash(p); table[i].ptr != 0; i = (i + 1) & (table_size - 1))
+		;
+	table[i].ptr = p;
+	table[i].id = id;
+	table_used++;
+}
+
+/*
+ * table_remove - Remove pointer p from the table, returning its id or
+ *     -1 if it isn't there. Later slots of the probe chain shift back
+ *     into the hole so no tombstones are needed.
+ */
+static int32_t table_remove(uintptr_t p)
+{
+	size_t i, j, h, mask = table_size - 1;
+	int32_t id;
+
+	for (i = hash(p); table[i].ptr != p; i = (i + 1) & mask)
+		if (table[i].ptr == 0)
+			return -1;
+	id = table[i].id;
+
+	for (j = (i + 1) & mask; table[j].ptr != 0; j = (j + 1) & mask)
+	{
+		h = hash(table[j].ptr);
+		/* move j back to i unless its home lies cyclically in (i, j] */
+		if (((j - h) & mask) >= ((j - i) & mask))
+		{
+			table[i] = table[j];
+			i = j;
+		}
+	}
+	table[i].ptr = 0;
+	table_used--;
+	return id;
+}
+
+/*
+ * stop - Give up recording, e.g. when out of memory or disk
+ */
+static void stop(const char *why)
+{
+	static const char msg[] = "mmrecord: recording stopped: ";
+
+	if (fd >= 0)
+	{
+		write(2, msg, sizeof(msg) - 1);
+		write(2, why, strlen(why));
+		write(2, "\n", 1);
+		close(fd);
+		fd = -1;
+	}
+}
+
+/*
+ * flush - Write out the buffered requests
+ */
+static void flush(void)
+{
+	char line[64], *out;
+	size_t len, off;
+	ssize_t n;
+	int i;
+	static char tbuf[BUF_OPS * 40]; /* longest line is "m <id> <align> <size>\n" */
+
+	if (text)
+	{
+		for (i = 0, out = tbuf; i < nbuf; i++)
+		{
+			if (buf[i].type == FREE)
+				len = snprintf(line, sizeof(line), "f %d\n", buf[i].index);
+			else if (buf[i].type == MEMALIGN)
+				len = snprintf(line, sizeof(line), "m %d %d %d\n",
+							   buf[i].index, buf[i].align, buf[i].size);
+			else
+				len = snprintf(line, sizeof(line), "%c %d %d\n",
+							   "afrc"[buf[i].type], buf[i].index, buf[i].size);
+			memcpy(out, line, len);
+			out += len;
+		}
+		len = out - tbuf;
+		out = tbuf;
+	}
+	else
+	{
+		len = nbuf * sizeof(traceop_t);
+		out = (char *)buf;
+	}
+
+	for (off = 0; off < len && fd >= 0; off += n)
+		if ((n = write(fd, out + off, len - off)) < 0)
+		{
+			if (errno == EINTR)
+				n = 0;
+			else
+				stop(strerror(errno));
+		}
+	nbuf = 0;
+}
+
+/*
+ * emit - Append a request to the buffer
+ */
+static void emit(RequestType type, int32_t id, size_t size, size_t align)
+{
+	if (num_ops == INT32_MAX)
+	{
+		stop("the trace format's limit on requests was reached");
+		return;
+	}
+	buf[nbuf].type = type;
+	buf[nbuf].index = id;
+	buf[nbuf].size = (type == FREE) ? 0 : (size == 0) ? 1 : (int32_t)size;
+	buf[nbuf].align = (type == MEMALIGN) ? (int32_t)align : 0;
+	num_ops++;
+	if (++nbuf == BUF_OPS)
+		flush();
+}
+
+/*
+ * record_alloc - Record the allocation of p by a request of the given
+ *     type (ALLOC, CALLOC or MEMALIGN to align bytes), or its move by
+ *     realloc from id (if id >= 0). Called by drain.
+ */
+static void record_alloc(void *p, size_t size, int32_t id,
+						 RequestType type, size_t align)
+{
+	if (fd < 0 || p == NULL || (uintptr_t)p - (uintptr_t)boot < BOOT_SIZE)
+		return;
+	if (size > INT32_MAX)
+	{
+		/* too big for the format; leave it out, and its free too */
+		if (id >= 0)
+			emit(FREE, id, 0, 0);
+		return;
+	}
+	if (2 * (table_used + 1) > table_size && !table_grow())
+	{
+		stop("out of memory for the id table");
+		return;
+	}
+
+	if (id < 0)
+	{
+		if (nfree_ids > 0)
+			id = free_ids[--nfree_ids];
+		else
+			id = next_id++;
+		if (type == MEMALIGN && align > INT32_MAX)
+			type = ALLOC; /* too big for the format; the size still counts */
+		emit(type, id, size, align);
+	}
+	else
+		emit(REALLOC, id, size, 0);
+
+	table_insert((uintptr_t)p, id);
+}
+
+/*
+ * record_free - Record that p is being freed, returning its id, or -1
+ *     if p isn't being tracked. With keep_id set, the id stays
+ *     reserved for the caller. Called by drain.
+ */
+static int32_t record_free(void *p, int keep_id)
+{
+	int32_t id;
+	int32_t *bigger;
+
+	if (fd < 0 || p == NULL || (id = table_remove((uintptr_t)p)) < 0)
+		return -1;
+	if (keep_id)
+		return id;
+	emit(FREE, id, 0, 0);
+
+	if (nfree_ids == free_ids_size)
+	{
+		bigger = get_pages((free_ids_size ? 2 * free_ids_size : TABLE_MIN) * sizeof(int32_t));
+		if (bigger == NULL)
+			return id; /* the id is simply not reused */
+		if (free_ids != NULL)
+		{
+			memcpy(bigger, free_ids, free_ids_size * sizeof(int32_t));
+			munmap(free_ids, free_ids_size * sizeof(int32_t));
+		}
+		free_ids = bigger;
+		free_ids_size = free_ids_size ? 2 * free_ids_size : TABLE_MIN;
+	}
+	free_ids[nfree_ids++] = id;
+	return id;
+}
+
+/*
+ * replay - Give event e of buffer b its ids and add it to the trace
+ */
+static void replay(tbuf_t *b, event_t *e)
+{
+	void *p = (void *)e->ptr;
+
+	switch (e->type)
+	{
+	case FREE:
+		record_free(p, 0);
+		break;
+	case MOVE_FROM:
+		b->moving = record_free(p, 1);
+		break;
+	case MOVE_BACK:
+		if (b->moving >= 0)
+			table_insert(e->ptr, b->moving);
+		b->moving = -1;
+		break;
+	case REALLOC:
+		record_alloc(p, e->size, b->moving, b->moving >= 0 ? REALLOC : ALLOC, 0);
+		b->moving = -1;
+		break;
+	default:
+		record_alloc(p, e->size, -1, (RequestType)e->type, e->align);
+	}
+}
+
+/*
+ * drain - Merge every thread's events into the trace in stamp order
+ *     and write it out. Called with the lock held. Each buffer is in
+ *     stamp order already, and while drain holds them all no thread
+ *     can stamp an event, so no event it leaves behind precedes one
+ *     it takes. The merge picks the lowest head by a scan of the
+ *     buffers, which costs little next to write(2) for the few threads
+ *     a traced program runs at once.
+ */
+static void drain(void)
+{
+	tbuf_t *b, *best;
+
+	for (b = tbufs; b != NULL; b = b->next)
+	{
+		pthread_mutex_lock(&b->lock);
+		b->head = 0;
+	}
+	for (;;)
+	{
+		best = NULL;
+		for (b = tbufs; b != NULL; b = b->next)
+			if (b->head < b->n &&
+				(best == NULL || b->ev[b->head].stamp < best->ev[best->head].stamp))
+				best = b;
+		if (best == NULL)
+			break;
+		if (fd >= 0)
+			replay(best, &best->ev[best->head]);
+		best->head++;
+	}
+	for (b = tbufs; b != NULL; b = b->next)
+	{
+		b->n = 0;
+		pthread_mutex_unlock(&b->lock);
+	}
+	flush();
+}
+
+/*
+ * tbuf_release - Thread-exit destructor of tbuf_key: hand the
+ *     thread's buffer, and the events still in it, to a later thread
+ */
+static void tbuf_release(void *b)
+{
+	mine = NULL;
+	__atomic_store_n(&((tbuf_t *)b)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * my_tbuf - The calling thread's buffer: one a thread that exited
+ *     left behind, or a new one. NULL if there is no memory for it.
+ *     Buffers join the list under the lock, so never during a drain.
+ */
+static tbuf_t *my_tbuf(void)
+{
+	tbuf_t *b;
+	int idle = 0;
+
+	if (mine != NULL)
+		return mine;
+	pthread_mutex_lock(&lock);
+	for (b = tbufs; b != NULL; b = b->next, idle = 0)
+		if (__atomic_compare_exchange_n(&b->in_use, &idle, 1, 0,
+										__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+	if (b == NULL && (b = get_pages(sizeof(tbuf_t))) != NULL)
+	{
+		pthread_mutex_init(&b->lock, NULL);
+		b->in_use = 1;
+		b->moving = -1;
+		b->next = tbufs;
+		tbufs = b;
+	}
+	pthread_mutex_unlock(&lock);
+	/* set mine first: pthread_setspecific may call malloc */
+	if ((mine = b) != NULL)
+		pthread_setspecific(tbuf_key, b);
+	return b;
+}
+
+/*
+ * note - Stamp a request of the calling thread and buffer it, draining
+ *     every buffer into the trace once this one is full
+ */
+static void note(int type, void *p, size_t size, size_t align)
+{
+	tbuf_t *b;
+	event_t *e;
+	int full;
+
+	if (fd < 0 || p == NULL || (b = my_tbuf()) == NULL)
+		return;
+	pthread_mutex_lock(&b->lock);
+	e = &b->ev[b->n];
+	e->stamp = __atomic_fetch_add(&stamp, 1, __ATOMIC_RELAXED);
+	e->ptr = (uintptr_t)p;
+	e->size = size;
+	e->align = align;
+	e->type = type;
+	full = ++b->n == THREAD_OPS;
+	pthread_mutex_unlock(&b->lock);
+	if (full)
+	{
+		pthread_mutex_lock(&lock);
+		drain();
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+/*
+ * record_exit - Write out the rest of the trace and its header
+ */
+static void record_exit(void)
+{
+	char line[64];
+	int len;
+
+	pthread_mutex_lock(&lock);
+	if (fd >= 0)
+		drain();
+	if (fd >= 0)
+	{
+		memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+		hdr.version = TRACE_VERSION;
+		hdr.sugg_heapsize = 0;
+		hdr.num_ids = next_id > 0 ? next_id : 1;
+		hdr.num_ops = (int32_t)num_ops;
+		hdr.weight = 1;
+		if (text)
+		{
+			len = snprintf(line, sizeof(line), TEXT_HDR, hdr.sugg_heapsize,
+						   hdr.num_ids, hdr.num_ops, hdr.weight);
+			pwrite(fd, line, len, 0);
+		}
+		else
+			pwrite(fd, &hdr, sizeof(hdr), 0);
+		close(fd);
+		fd = -1;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * record_child - A forked child has a copy of the parent's trace
+ *     file position but its own heap, so it doesn't record
+ */
+static void record_child(void)
+{
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+	pthread_mutex_init(&lock, NULL);
+}
+
+static void record_prepare(void)
+{
+	pthread_mutex_lock(&lock);
+}
+
+static void record_parent(void)
+{
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * record_init - Find the real allocator and open the trace file
+ */
+__attribute__((constructor)) static void record_init(void)
+{
+	char name[64], line[64];
+	const char *path, *t;
+	int len;
+
+	if (real_malloc != NULL || booting)
+		return;
+	booting = 1;
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+	real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+	real_memalign = dlsym(RTLD_NEXT, "memalign");
+	booting = 0;
+	if (real_malloc == NULL || real_calloc == NULL ||
+		real_realloc == NULL || real_free == NULL)
+	{
+		write(2, "mmrecord: can't find the real allocator\n", 40);
+		_exit(127);
+	}
+
+	if ((path = getenv("MMRECORD_FILE")) == NULL)
+	{
+		snprintf(name, sizeof(name), "mmrecord.%d.bin", (int)getpid());
+		path = name;
+	}
+	text = (t = getenv("MMRECORD_TEXT")) != NULL && *t != '\0' && *t != '0';
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+		return;
+	if (!table_grow())
+	{
+		stop("out of memory for the id table");
+		return;
+	}
+	pthread_key_create(&tbuf_key, tbuf_release);
+
+	/* Leave room for the header, which is written at exit */
+	if (text)
+	{
+		len = snprintf(line, sizeof(line), TEXT_HDR, 0, 0, 0, 0);
+		write(fd, line, len);
+	}
+	else
+	{
+		memset(&hdr, 0, sizeof(hdr));
+		write(fd, &hdr, sizeof(hdr));
+	}
+	pthread_atfork(record_prepare, record_parent, record_child);
+	atexit(record_exit);
+}
+
+/*
+ * boot_alloc - Serve the allocations dlsym makes before the real
+ *     allocator is known. They are never freed.
+ */
+static void *boot_alloc(size_t size)
+{
+	void *p;
+
+	size = (size + 15) & ~(size_t)15;
+	if (size > BOOT_SIZE - boot_used)
+		return NULL;
+	p = boot + boot_used;
+	boot_used += size;
+	return p;
+}
+
+/*
+ * The interposed allocator
+ */
+void *malloc(size_t size)
+{
+	void *p;
+
+	if (real_malloc == NULL)
+	{
+		if (booting)
+			return boot_alloc(size);
+		record_init();
+	}
+	p = real_malloc(size);
+	note(ALLOC, p, size, 0);
+	return p;
+}
+
+void *calloc(size_t n, size_t size)
+{
+	void *p;
+
+	if (real_calloc == NULL)
+	{
+		if (booting)
+			return (n == 0 || size <= BOOT_SIZE / n) ? boot_alloc(n * size) : NULL;
+		record_init();
+	}
+	p = real_calloc(n, size);
+	note(CALLOC, p, n * size, 0);
+	return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	void *p;
+
+	if (ptr == NULL)
+		return malloc(size);
+	if ((uintptr_t)ptr - (uintptr_t)boot < BOOT_SIZE)
+	{
+		/* boot blocks don't know their size; copy what might be there */
+		size_t avail = boot + BOOT_SIZE - (char *)ptr;
+
+		if ((p = malloc(size)) != NULL)
+			memcpy(p, ptr, size < avail ? size : avail);
+		return p;
+	}
+	if (size == 0)
+	{
+		free(ptr);
+		return NULL;
+	}
+
+	note(MOVE_FROM, ptr, 0, 0);
+	if ((p = real_realloc(ptr, size)) != NULL)
+		note(REALLOC, p, size, 0);
+	else
+		note(MOVE_BACK, ptr, 0, 0);
+	return p;
+}
+
+void free(void *ptr)
+{
+	if (ptr == NULL || (uintptr_t)ptr - (uintptr_t)boot < BOOT_SIZE)
+		return;
+	if (real_free == NULL)
+		record_init();
+	note(FREE, ptr, 0, 0);
+	real_free(ptr);
+}
+
+/*
+ * The aligned allocators are all recorded as memaligns
+ */
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+	int err;
+
+	if (real_posix_memalign == NULL)
+		record_init();
+	if ((err = real_posix_memalign(memptr, align, size)) == 0)
+		note(MEMALIGN, *memptr, size, align);
+	return err;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+	void *p;
+
+	if (real_aligned_alloc == NULL)
+		record_init();
+	p = real_aligned_alloc(align, size);
+	note(MEMALIGN, p, size, align);
+	return p;
+}
+
+void *memalign(size_t align, size_t size)
+{
+	void *p;
+
+	if (real_memalign == NULL)
+		record_init();
+	p = real_memalign(align, size);
+	note(MEMALIGN, p, size, align);
+	return p;
+}
@@ -0,0 +1,123 @@
+/*
+ * perfctr.c - Count hardware events with Linux perf_event_open(2)
+ *
+ * Each event gets its own counter rather than one group, so an event
+ * the CPU can't count, or one more than it has counters for, costs
+ * only that event. Only user-mode events are counted, which is all
+ * that perf_event_paranoid=2 allows unprivileged users anyway.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* 
+ * What each event is, in the kernel's terms. The cache events are
+ * PERF_TYPE_HW_CACHE ids: cache | (op << 8) | (result << 16).
+ */
+#define CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    unsigned type;
+    unsigned long long config;
+} events[PERFCTR_NEVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static int fds[PERFCTR_NEVENTS]; /* counter of each event, or -1 */
+
+/*
+ * perfctr_init - Open a counter for each event we're allowed to count
+ */
+int perfctr_init(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < PERFCTR_NEVENTS; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] >= 0)
+	    n++;
+    }
+    return n;
+}
+
+/*
+ * perfctr_start - Zero the open counters and start them
+ */
+void perfctr_start(void)
+{
+    int i;
+
+    for (i = 0; i < PERFCTR_NEVENTS; i++)
+	if (fds[i] >= 0) {
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+/*
+ * perfctr_stop - Stop the counters and report what they counted
+ */
+void perfctr_stop(double counts[PERFCTR_NEVENTS])
+{
+    unsigned long long v[3]; /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PERFCTR_NEVENTS; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PERFCTR_NEVENTS; i++) {
+	counts[i] = -1;
+	if (fds[i] < 0 || read(fds[i], v, sizeof(v)) != sizeof(v) || v[2] == 0)
+	    continue;
+	/* the counter only ran part of the time; extrapolate */
+	counts[i] = (double)v[0] * v[1] / v[2];
+    }
+}
+
+#else /* !__linux__ */
+
+/*
+ * Without perf_event_open there is nothing to count
+ */
+int perfctr_init(void)
+{
+    return 0;
+}
+
+void perfctr_start(void)
+{
+}
+
+void perfctr_stop(double counts[PERFCTR_NEVENTS])
+{
+    int i;
+
+    for (i = 0; i < PERFCTR_NEVENTS; i++)
+	counts[i] = -1;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,31 @@
+/*
+ * perfctr.h - prototypes for the routines in perfctr.c that count
+ *     hardware events (cache and TLB misses, instructions, branch
+ *     mispredicts) while a test function runs
+ */
+
+/* The events counted, in the order perfctr_stop reports them */
+#define PERFCTR_CYCLES       0
+#define PERFCTR_INSTRUCTIONS 1
+#define PERFCTR_L1D_MISSES   2
+#define PERFCTR_LLC_MISSES   3
+#define PERFCTR_DTLB_MISSES  4
+#define PERFCTR_BRANCH_MISSES 5
+#define PERFCTR_NEVENTS      6
+
+/* 
+ * perfctr_init - Open a counter for each event in this process. 
+ *     Returns the number that could be opened; events the CPU, kernel
+ *     or perf_event_paranoid setting doesn't allow are left out.
+ */
+int perfctr_init(void);
+
+/* perfctr_start - Zero the open counters and start them */
+void perfctr_start(void);
+
+/* 
+ * perfctr_stop - Stop the counters and store each event's count in
+ *     counts[], scaled up if the kernel had to multiplex it with other
+ *     events. An event that isn't being counted reads as -1.
+ */
+void perfctr_stop(double counts[PERFCTR_NEVENTS]);
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+# Compare two mdriver -J result files and flag regressions:
+#
+#   ./mdriver -a -r 5 -J baseline.json      (before the change)
+#   ./mdriver -a -r 5 -J current.json       (after it)
+#   ./regress-malloc.py baseline.json current.json
+#
+# A trace regresses in util when it drops by more than --util-tol
+# (util is deterministic), and in throughput when a Welch t-test on
+# the -r speed samples says it got slower at level --alpha and by
+# more than --min-slowdown.  With fewer than two samples on a side
+# only the slowdown threshold applies.  Traces that were valid and
+# became invalid always regress.  Exits 1 if anything regressed.
+# Runs taken with different -m, -c or -k settings still compare, with
+# a warning, since their times measure different things.
+#
+
+import sys
+import json
+import math
+import argparse
+
+
+def betacf(a, b, x):
+    """Continued fraction of the incomplete beta function (Lentz)."""
+    tiny = 1e-300
+    qab, qap, qam = a + b, a + 1.0, a - 1.0
+    c, d = 1.0, 1.0 - qab * x / qap
+    d = 1.0 / (d if abs(d) > tiny else tiny)
+    h = d
+    for m in range(1, 200):
+        m2 = 2 * m
+        aa = m * (b - m) * x / ((qam + m2) * (a + m2))
+        d = 1.0 + aa * d
+        d = 1.0 / (d if abs(d) > tiny else tiny)
+        c = 1.0 + aa / c
+        c = c if abs(c) > tiny else tiny
+        h *= d * c
+        aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2))
+        d = 1.0 + aa * d
+        d = 1.0 / (d if abs(d) > tiny else tiny)
+        c = 1.0 + aa / c
+        c = c if abs(c) > tiny else tiny
+        delta = d * c
+        h *= delta
+        if abs(delta - 1.0) < 1e-12:
+            break
+    return h
+
+
+def betai(a, b, x):
+    """Regularized incomplete beta function I_x(a, b)."""
+    if x <= 0.0:
+        return 0.0
+    if x >= 1.0:
+        return 1.0
+    lbeta = math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b)
+    front = math.exp(lbeta + a * math.log(x) + b * math.log(1.0 - x))
+    if x < (a + 1.0) / (a + b + 2.0):
+        return front * betacf(a, b, x) / a
+    return 1.0 - front * betacf(b, a, 1.0 - x) / b
+
+
+def welch(xs, ys):
+    """One-sided p-value that mean(ys) > mean(xs), by Welch's t-test."""
+    nx, ny = len(xs), len(ys)
+    mx, my = sum(xs) / nx, sum(ys) / ny
+    vx = sum((x - mx) ** 2 for x in xs) / (nx - 1)
+    vy = sum((y - my) ** 2 for y in ys) / (ny - 1)
+    se2 = vx / nx + vy / ny
+    if se2 == 0.0:
+        return 0.0 if my > mx else 1.0
+    t = (my - mx) / math.sqrt(se2)
+    df = se2 ** 2 / ((vx / nx) ** 2 / (nx - 1) + (vy / ny) ** 2 / (ny - 1))
+    tail = 0.5 * betai(df / 2.0, 0.5, df / (df + t * t))
+    return tail if t > 0 else 1.0 - tail
+
+
+def median(xs):
+    s = sorted(xs)
+    n = len(s)
+    return s[n // 2] if n % 2 else (s[n // 2 - 1] + s[n // 2]) / 2
+
+
+def compare(name, base, cur, args):
+    """Print one line per trace of allocator name; return the regressions."""
+    regressions = 0
+    bytrace = {t["trace"]: t for t in base}
+    for t in cur:
+        b = bytrace.get(t["trace"])
+        if b is None or not b["valid"]:
+            continue
+        what = []
+        if not t["valid"]:
+            what.append("no longer valid")
+        else:
+            du = t["util"] - b["util"]
+            if du < -args.util_tol:
+                what.append(f"util {b['util']*100:.1f}% -> {t['util']*100:.1f}%")
+            bs, cs = b["secs"], t["secs"]
+            slowdown = median(cs) / median(bs) - 1.0
+            if slowdown > args.min_slowdown:
+                if len(bs) < 2 or len(cs) < 2:
+                    what.append(f"{slowdown*100:.1f}% slower (single sample)")
+                else:
+                    p = welch(bs, cs)
+                    if p < args.alpha:
+                        what.append(f"{slowdown*100:.1f}% slower (p={p:.3g})")
+        status = "REGRESSED " + ", ".join(what) if what else "ok"
+        print(f"{name:<12} {t['trace']:<24} {status}")
+        regressions += len(what) > 0
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare mdriver -J results")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--util-tol", type=float, default=0.005,
+                        help="util drop tolerated, as a fraction (default 0.005)")
+    parser.add_argument("--alpha", type=float, default=0.05,
+                        help="significance level of the t-test (default 0.05)")
+    parser.add_argument("--min-slowdown", type=float, default=0.03,
+                        help="smallest slowdown reported, as a fraction (default 0.03)")
+    args = parser.parse_args()
+
+    with open(args.baseline) as f:
+        base = json.load(f)
+    with open(args.current) as f:
+        cur = json.load(f)
+
+    if base.get("timing") != cur.get("timing"):
+        print(f"warning: timed as {base.get('timing')}, then as {cur.get('timing')}",
+              file=sys.stderr)
+
+    regressions = 0
+    for name, traces in cur["allocators"].items():
+        if name in base["allocators"]:
+            regressions += compare(name, base["allocators"][name], traces, args)
+    print(f"perfidx {base['perfidx']} -> {cur['perfidx']}, "
+          f"{regressions} regressed trace(s)")
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
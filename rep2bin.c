@@ -0,0 +1,140 @@
+/*
+ * rep2bin.c - Convert a text .rep trace to the binary trace format
+ *
+ * usage: rep2bin <in.rep> <out.bin>
+ *
+ * The binary format is described in trace.h. The ops are streamed to
+ * the output as they are parsed, so traces of any length convert in
+ * constant memory. Either file may be "-" for stdin or stdout.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define MAXLINE 2048 /* max string size */
+
+static const char *inname; /* for error messages */
+
+/*
+ * die - Report an error in the input trace and exit
+ */
+static void die(const char *what, long opnum)
+{
+	if (opnum >= 0)
+		fprintf(stderr, "rep2bin: %s: %s (op %ld)\n", inname, what, opnum);
+	else
+		fprintf(stderr, "rep2bin: %s: %s\n", inname, what);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *in, *out;
+	tracehdr_t hdr;
+	traceop_t op;
+	char type[MAXLINE];
+	long n, last;
+	long max_index = -1;
+
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s <in.rep> <out.bin>\n", argv[0]);
+		exit(1);
+	}
+	inname = argv[1];
+	if ((in = strcmp(argv[1], "-") ? fopen(argv[1], "r") : stdin) == NULL)
+	{
+		perror(argv[1]);
+		exit(1);
+	}
+	if ((out = strcmp(argv[2], "-") ? fopen(argv[2], "wb") : stdout) == NULL)
+	{
+		perror(argv[2]);
+		exit(1);
+	}
+
+	/* The header fields are the four numbers that start a text trace */
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = TRACE_VERSION;
+	if (fscanf(in, "%d %d %d %d", &hdr.sugg_heapsize, &hdr.num_ids,
+			   &hdr.num_ops, &hdr.weight) != 4)
+		die("bad trace header", -1);
+	if (hdr.num_ids <= 0 || hdr.num_ops < 0)
+		die("bad trace header", -1);
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+	{
+		perror(argv[2]);
+		exit(1);
+	}
+
+	for (n = 0; fscanf(in, "%s", type) != EOF; n++)
+	{
+		if (n == hdr.num_ops)
+			die("more ops than the header says", n);
+		memset(&op, 0, sizeof(op));
+		switch (type[0])
+		{
+		case 'a':
+		case 'c':
+		case 'r':
+			op.type = (type[0] == 'a') ? ALLOC : (type[0] == 'c') ? CALLOC : REALLOC;
+			if (fscanf(in, "%d %d", &op.index, &op.size) != 2)
+				die("bad allocation request", n);
+			break;
+		case 'm':
+			op.type = MEMALIGN;
+			if (fscanf(in, "%d %d %d", &op.index, &op.align, &op.size) != 3)
+				die("bad memalign request", n);
+			if (op.align <= 0 || (op.align & (op.align - 1)) != 0)
+				die("alignment is not a power of two", n);
+			break;
+		case 'A':
+			op.type = ALLOC_BATCH;
+			if (fscanf(in, "%d %d %d", &op.index, &op.count, &op.size) != 3)
+				die("bad batch allocation request", n);
+			break;
+		case 'F':
+			op.type = FREE_BATCH;
+			if (fscanf(in, "%d %d", &op.index, &op.count) != 2)
+				die("bad batch free request", n);
+			break;
+		case 'f':
+			op.type = FREE;
+			if (fscanf(in, "%d", &op.index) != 1)
+				die("bad free request", n);
+			break;
+		default:
+			die("bogus request type", n);
+		}
+		if ((op.type == ALLOC_BATCH || op.type == FREE_BATCH) && op.count <= 0)
+			die("empty batch", n);
+		if (op.type != ALLOC_BATCH && op.type != FREE_BATCH)
+			last = op.index;
+		else if ((last = (long)op.index + op.count - 1) >= hdr.num_ids)
+			die("batch runs past the last block id", n);
+		if (op.index < 0 || op.index >= hdr.num_ids)
+			die("block id out of range", n);
+		if (op.type != FREE && op.type != FREE_BATCH && last > max_index)
+			max_index = last;
+		if (fwrite(&op, sizeof(op), 1, out) != 1)
+		{
+			perror(argv[2]);
+			exit(1);
+		}
+	}
+	if (n != hdr.num_ops)
+		die("fewer ops than the header says", n);
+	if (max_index != hdr.num_ids - 1)
+		die("num_ids does not match the block ids used", -1);
+
+	if (fclose(out) != 0)
+	{
+		perror(argv[2]);
+		exit(1);
+	}
+	fclose(in);
+	return 0;
+}
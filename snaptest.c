@@ -0,0 +1,154 @@
+/*
+ * snaptest.c - Restore a heap snapshot in a fresh process and keep
+ *     using it, for "make tests-snapshot":
+ *
+ *         ./snaptest save <file>             prints a root pointer
+ *         ./snaptest restore <file> <root>   exits 1 on any failure
+ *
+ * The saved heap holds a list of small blocks, each with a padding
+ * block, and one block big enough to get its own mapping.  The
+ * restoring process walks the list, then grows the big block far past
+ * its saved size, writes the whole of it and frees everything.  Most
+ * of the restored heap's pages must then go back to the system.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mm.h"
+#include "memlib.h"
+
+#define NODES     10000
+#define BIG       200000      /* mapped on its own (MMAP_THRESHOLD) */
+#define BIG_GROWN 2000000
+#define PAD       2000        /* per node: 20MB in all, past RELEASE_THRESHOLD */
+
+extern void mm_checkheap(int verbose);
+
+typedef struct node {
+    struct node *next;
+    int v;
+    char *pad;
+    char *big;
+} node_t;
+
+static int fail(const char *msg)
+{
+    fprintf(stderr, "snaptest: %s\n", msg);
+    return 1;
+}
+
+/*
+ * resident_kb - the kilobytes of [lo, hi) that the process still holds
+ *     in memory, from /proc/self/smaps.  Pages the system may reclaim
+ *     at will (LazyFree, after MADV_FREE) do not count.  Whole areas
+ *     that overlap the range are counted.  Returns -1 if smaps can't
+ *     be read.
+ */
+static long resident_kb(char *lo, char *hi)
+{
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    char line[256];
+    unsigned long start, end;
+    long kb, total = 0;
+    int in = 0;
+
+    if (fp == NULL)
+	return -1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+	    in = start < (unsigned long)hi && end > (unsigned long)lo;
+	else if (in && sscanf(line, "Rss: %ld kB", &kb) == 1)
+	    total += kb;
+	else if (in && sscanf(line, "LazyFree: %ld kB", &kb) == 1)
+	    total -= kb;
+    }
+    fclose(fp);
+    return total;
+}
+
+static int save(const char *path)
+{
+    node_t *root = NULL, *n;
+    int i;
+
+    mm_init();
+    for (i = 0; i < NODES; i++) {
+	if ((n = mm_malloc(sizeof(*n) + (i % 7) * 8)) == NULL)
+	    return fail("mm_malloc failed");
+	if ((n->pad = mm_malloc(PAD)) == NULL)
+	    return fail("mm_malloc failed");
+	memset(n->pad, i, PAD);
+	n->next = root;
+	n->v = i;
+	n->big = NULL;
+	root = n;
+    }
+    if ((root->big = mm_malloc(BIG)) == NULL)
+	return fail("mm_malloc of the big block failed");
+    memset(root->big, 0x5a, BIG);
+    if (mm_snapshot(path) != 0) {
+	perror("snaptest: mm_snapshot");
+	return 1;
+    }
+    printf("%p\n", (void *)root);
+    return 0;
+}
+
+static int restore(const char *path, node_t *root)
+{
+    node_t *n, *next;
+    char *big, *lo, *hi;
+    long sum = 0, before, after;
+    int i, count = 0;
+
+    if (mm_restore(path) != 0) {
+	perror("snaptest: mm_restore");
+	return 1;
+    }
+    for (n = root; n != NULL; n = n->next) {
+	sum += n->v + (unsigned char)n->pad[PAD - 1];
+	count++;
+    }
+    for (i = 0; i < NODES; i++)
+	sum -= i + (unsigned char)i;
+    if (count != NODES || sum != 0)
+	return fail("the list did not survive the restore");
+    lo = mem_heap_lo();
+    hi = (char *)mem_heap_hi() + 1;
+    before = resident_kb(lo, hi);
+
+    big = root->big;
+    for (i = 0; i < BIG; i++)
+	if (big[i] != 0x5a)
+	    return fail("the big block did not survive the restore");
+    if ((big = mm_realloc(big, BIG_GROWN)) == NULL)
+	return fail("mm_realloc of the big block failed");
+    for (i = 0; i < BIG; i++)
+	if (big[i] != 0x5a)
+	    return fail("mm_realloc lost the big block's data");
+    memset(big, 0xa5, BIG_GROWN);          /* the grown tail too */
+    mm_free(big);
+
+    for (n = root; n != NULL; n = next) {
+	next = n->next;
+	mm_free(n->pad);
+	mm_free(n);
+    }
+    mm_checkheap(0);
+
+    after = resident_kb(lo, hi);
+    if (before > 0 && after > before / 2)
+	return fail("freeing the restored heap did not release its pages");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    mem_init();
+    if (argc == 3 && !strcmp(argv[1], "save"))
+	return save(argv[2]);
+    if (argc == 4 && !strcmp(argv[1], "restore"))
+	return restore(argv[2], (node_t *)strtoull(argv[3], NULL, 16));
+    fprintf(stderr, "usage: snaptest save <file> | restore <file> <root>\n");
+    return 2;
+}
@@ -0,0 +1,143 @@
+/*
+ * sysbackend.c - Off-the-shelf malloc packages as mdriver backends
+ *     (see backend.h)
+ *
+ * Built plain into glibc.so, with -DSYS_JEMALLOC into jemalloc.so and
+ * with -DSYS_TCMALLOC into tcmalloc.so. mdriver's own malloc is the
+ * C library's, so the jemalloc and tcmalloc backends call those
+ * packages' prefixed entry points (mallocx, tc_malloc, ...), which
+ * the unprefixed malloc of the process can't shadow.
+ *
+ * None of these packages can be reset, so init does nothing and a
+ * replay starts from whatever the last one left behind. The stats of
+ * the glibc backend are those of the process's whole malloc heap,
+ * mdriver's own blocks included, so its utilization is a lower bound.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "backend.h"
+
+#if defined(SYS_JEMALLOC)
+#include <jemalloc/jemalloc.h>
+
+static void *sys_malloc(size_t size)
+{
+	return mallocx(size ? size : 1, 0);
+}
+
+static void sys_free(void *ptr)
+{
+	if (ptr != NULL)
+		dallocx(ptr, 0);
+}
+
+static void *sys_realloc(void *ptr, size_t size)
+{
+	if (ptr == NULL)
+		return sys_malloc(size);
+	return rallocx(ptr, size ? size : 1, 0);
+}
+
+static void *sys_calloc(size_t nmemb, size_t size)
+{
+	return mallocx(nmemb * size ? nmemb * size : 1, MALLOCX_ZERO);
+}
+
+static void *sys_memalign(size_t align, size_t size)
+{
+	return mallocx(size ? size : 1, MALLOCX_ALIGN(align));
+}
+
+/*
+ * jem_stat - One of jemalloc's size_t statistics, by mallctl name
+ */
+static size_t jem_stat(const char *name)
+{
+	size_t v = 0, len = sizeof(v);
+
+	mallctl(name, &v, &len, NULL, 0);
+	return v;
+}
+
+static void sys_stats(struct mm_stats *st)
+{
+	uint64_t epoch = 1;
+	size_t len = sizeof(epoch);
+
+	/* the statistics are a snapshot, refreshed by writing the epoch */
+	mallctl("epoch", &epoch, &len, &epoch, len);
+	memset(st, 0, sizeof(*st));
+	st->heap_size = jem_stat("stats.mapped");
+	st->live_bytes = jem_stat("stats.allocated");
+	st->free_bytes = jem_stat("stats.active") - st->live_bytes;
+}
+
+#elif defined(SYS_TCMALLOC)
+#include <gperftools/tcmalloc.h>
+#include <gperftools/malloc_extension_c.h>
+
+#define sys_malloc tc_malloc
+#define sys_free tc_free
+#define sys_realloc tc_realloc
+#define sys_calloc tc_calloc
+#define sys_memalign tc_memalign
+
+/*
+ * tc_stat - One of tcmalloc's numeric properties, by name
+ */
+static size_t tc_stat(const char *name)
+{
+	size_t v = 0;
+
+	MallocExtension_GetNumericProperty(name, &v);
+	return v;
+}
+
+static void sys_stats(struct mm_stats *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->heap_size = tc_stat("generic.heap_size") -
+					tc_stat("tcmalloc.pageheap_unmapped_bytes");
+	st->live_bytes = tc_stat("generic.current_allocated_bytes");
+	st->free_bytes = st->heap_size - st->live_bytes;
+}
+
+#else /* the C library's malloc */
+#include <malloc.h>
+
+#define sys_malloc malloc
+#define sys_free free
+#define sys_realloc realloc
+#define sys_calloc calloc
+#define sys_memalign aligned_alloc
+
+static void sys_stats(struct mm_stats *st)
+{
+	struct mallinfo2 mi = mallinfo2();
+
+	memset(st, 0, sizeof(*st));
+	st->heap_size = mi.arena;
+	st->mapped_bytes = mi.hblkhd;
+	st->live_bytes = mi.uordblks;
+	st->free_bytes = mi.fordblks;
+}
+#endif
+
+static int sys_init(void)
+{
+	return 0;
+}
+
+__attribute__((visibility("default"))) const mm_backend_t mm_backend = {
+	.abi = MM_BACKEND_ABI,
+	.init = sys_init,
+	.malloc = sys_malloc,
+	.free = sys_free,
+	.realloc = sys_realloc,
+	.calloc = sys_calloc,
+	.memalign = sys_memalign,
+	.stats = sys_stats,
+};
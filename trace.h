@@ -0,0 +1,60 @@
+/*
+ * trace.h - Layout of binary trace files
+ *
+ * A binary trace holds the same information as a text .rep file: a
+ * fixed header with the four text header fields, followed directly by
+ * the num_ops requests as a packed array of traceop_t records. The
+ * driver maps the file and replays the array in place, so the record
+ * layout here is also the driver's in-memory request format. Files
+ * are written in host byte order; version doubles as a byte-order
+ * check. Use rep2bin to convert a text trace.
+ *
+ * Each request of a text trace is one line: "a <id> <size>" (malloc),
+ * "c <id> <size>" (calloc), "m <id> <align> <size>" (memalign),
+ * "r <id> <size>" (realloc) or "f <id>" (free). A batch covers the n
+ * ids from <id> up: "A <id> <n> <size>" allocates n blocks of one size
+ * (mm_malloc_batch) and "F <id> <n>" frees them (mm_free_batch).
+ */
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "MMTR"   /* first four bytes of a binary trace */
+#define TRACE_VERSION 2   /* 2 added CALLOC, MEMALIGN, the batches and align */
+
+/* Characterizes a single trace operation (allocator request) */
+typedef enum
+{
+	ALLOC,
+	FREE,
+	REALLOC,
+	CALLOC,		 /* zeroed allocation, like ALLOC */
+	MEMALIGN,	 /* aligned allocation, like ALLOC */
+	ALLOC_BATCH, /* count allocations of one size, ids index and up */
+	FREE_BATCH	 /* count frees, ids index and up */
+} RequestType;
+typedef struct
+{
+	int32_t type;  /* type of request, a RequestType */
+	int32_t index; /* index for free() to use later */
+	int32_t size;  /* byte size of alloc/realloc request */
+	union
+	{
+		int32_t align; /* alignment of a memalign request, else 0 */
+		int32_t count; /* number of blocks of a batch request */
+	};
+} traceop_t;
+
+/* Header of a binary trace file */
+typedef struct
+{
+	char magic[4];		   /* TRACE_MAGIC */
+	uint32_t version;	   /* TRACE_VERSION */
+	int32_t sugg_heapsize; /* suggested heap size (unused) */
+	int32_t num_ids;	   /* number of alloc/realloc ids */
+	int32_t num_ops;	   /* number of distinct requests */
+	int32_t weight;		   /* weight for this trace (unused) */
+} tracehdr_t;
+
+#endif /* __TRACE_H_ */
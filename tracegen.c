@@ -0,0 +1,513 @@
+/*
+ * tracegen.c - Generate synthetic allocator traces
+ *
+ * usage: tracegen [options] -o <out.rep>
+ *
+ * Writes a trace in the text .rep format (or, with -b, the binary
+ * format in trace.h) whose requests follow the given size and
+ * lifetime distributions. Every block gets a time of death when it is
+ * allocated, measured in requests; blocks are freed when their time
+ * comes, or earlier when another allocation would push the live bytes
+ * over the -w target. Ids of freed blocks are reused, so num_ids is
+ * the most blocks live at once. All blocks still live at the end are
+ * freed, so the trace is balanced like the ones in traces/.
+ *
+ * With -g, blocks are allocated in groups of equal blocks with
+ * consecutive ids that share a time of death, and each group is one
+ * batch request each way. -G writes the same groups as single
+ * requests instead, so that the two traces from one seed make the
+ * same requests, one batched and one not. Lifetimes and -n are still
+ * counted in single requests.
+ *
+ * Distributions are given as name:args:
+ *   fixed:A,B,...        one of the listed values, with equal odds
+ *   uniform:LO,HI        uniform on [LO, HI]
+ *   exp:MEAN             exponential
+ *   lognormal:MEDIAN,S   lognormal with the given median and sigma
+ *   bimodal:A,B,P        lognormal (sigma 0.25) around A, or around B
+ *                        with probability P
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "trace.h"
+
+#define MAXARGS 64			/* most values a distribution takes */
+#define MAXSIZE (1 << 28)	/* largest request generated */
+#define BIMODAL_SIGMA 0.25	/* spread of each mode of a bimodal */
+
+/* A distribution to draw sizes or lifetimes from */
+typedef enum
+{
+	DIST_FIXED,
+	DIST_UNIFORM,
+	DIST_EXP,
+	DIST_LOGNORMAL,
+	DIST_BIMODAL
+} dist_type_t;
+typedef struct
+{
+	dist_type_t type;
+	int nargs;
+	double arg[MAXARGS];
+} dist_t;
+
+/* A live block, in the heap of blocks ordered by time of death */
+typedef struct
+{
+	long death; /* request number at which it is freed */
+	int id;		/* its block id */
+} death_t;
+
+/* Options, with their defaults */
+static long num_ops = 100000;		/* requests to generate (-n) */
+static double live_target = 1 << 24; /* most live bytes (-w) */
+static double realloc_p = 0;		/* odds a request is a realloc (-r) */
+static double realloc_f = 1.5;		/* ... that multiplies the size */
+static int realloc_add = 0;			/* ... or that adds realloc_f bytes */
+static double calloc_p = 0;			/* odds an allocation is a calloc (-c) */
+static double memalign_p = 0;		/* odds an allocation is a memalign (-m) */
+static int memalign_align = 64;		/* ... and its alignment */
+static int group = 1;				/* blocks per allocation (-g) */
+static int unbatched = 0;			/* ... written as single requests (-G) */
+static int binary = 0;				/* write the binary format (-b) */
+static uint64_t seed = 1;			/* for the random numbers (-S) */
+
+/* The generator's state */
+static FILE *out;
+static death_t *heap;	/* live blocks, earliest death first */
+static int nheap;
+static int *live;		/* live block ids, in no order... */
+static int *live_pos;	/* ... and where each id is in live[] */
+static int *sizes;		/* current size of each block id */
+static int *free_ids;	/* ids ready for reuse */
+static int nfree_ids;
+static int next_id;		/* ids below this have been used */
+static int max_ids;		/* size of the arrays above */
+static double live_bytes, peak_bytes;
+static long ops;		/* requests written so far */
+static long reqs;		/* ... counting each block of a batch */
+
+/*
+ * die - Print an error and exit
+ */
+static void die(const char *msg)
+{
+	fprintf(stderr, "tracegen: %s\n", msg);
+	exit(1);
+}
+
+/*
+ * usage - Explain the command line
+ */
+static void usage(void)
+{
+	fprintf(stderr,
+			"Usage: tracegen [options] -o <file>\n"
+			"Options\n"
+			"\t-b         Write the binary trace format.\n"
+			"\t-c <p>     Make a fraction p of allocations callocs.\n"
+			"\t-g <n>     Allocate and free blocks in batches of n.\n"
+			"\t-G         Write the batches of -g as single requests.\n"
+			"\t-l <dist>  Lifetimes, in requests (default exp:1000).\n"
+			"\t-m <p,a>   Make a fraction p of allocations memaligns to a\n"
+			"\t           bytes, a power of two.\n"
+			"\t-n <ops>   Number of requests (default 100000).\n"
+			"\t-o <file>  Write the trace to <file>.\n"
+			"\t-r <p,f>   Make a fraction p of requests reallocs of a live\n"
+			"\t           block, multiplying its size by f (or adding f\n"
+			"\t           bytes if f starts with +).\n"
+			"\t-s <dist>  Request sizes, in bytes (default lognormal:64,1).\n"
+			"\t-S <seed>  Seed for the random numbers (default 1).\n"
+			"\t-w <bytes> Most live bytes at a time (default 16M).\n"
+			"Distributions: fixed:A,B,...  uniform:LO,HI  exp:MEAN\n"
+			"               lognormal:MEDIAN,SIGMA  bimodal:A,B,P\n");
+}
+
+/*
+ * rand64 - xorshift64* pseudo-random numbers
+ */
+static uint64_t rand64(void)
+{
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return seed * 0x2545F4914F6CDD1DULL;
+}
+
+/* Uniform on (0, 1) */
+static double rand_unit(void)
+{
+	return ((rand64() >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/* Standard normal, by Box-Muller */
+static double rand_normal(void)
+{
+	return sqrt(-2 * log(rand_unit())) * cos(2 * M_PI * rand_unit());
+}
+
+/*
+ * parse_dist - Parse a distribution given as name:args
+ */
+static void parse_dist(const char *spec, dist_t *d)
+{
+	static const struct
+	{
+		const char *name;
+		dist_type_t type;
+		int min, max; /* number of args */
+	} dists[] = {
+		{"fixed", DIST_FIXED, 1, MAXARGS},
+		{"uniform", DIST_UNIFORM, 2, 2},
+		{"exp", DIST_EXP, 1, 1},
+		{"lognormal", DIST_LOGNORMAL, 2, 2},
+		{"bimodal", DIST_BIMODAL, 3, 3},
+	};
+	const char *p = strchr(spec, ':');
+	char *end;
+	size_t i;
+
+	if (p == NULL)
+		die("a distribution is name:args, e.g. lognormal:64,1");
+	for (i = 0; i < sizeof(dists) / sizeof(dists[0]); i++)
+		if (strlen(dists[i].name) == (size_t)(p - spec) &&
+			!strncmp(spec, dists[i].name, p - spec))
+			break;
+	if (i == sizeof(dists) / sizeof(dists[0]))
+		die("unknown distribution");
+
+	d->type = dists[i].type;
+	for (d->nargs = 0; d->nargs < MAXARGS && *p != '\0'; p = end)
+	{
+		d->arg[d->nargs++] = strtod(p + 1, &end);
+		if (end == p + 1 || (*end != ',' && *end != '\0'))
+			die("bad distribution argument");
+	}
+	if (d->nargs < dists[i].min || d->nargs > dists[i].max)
+		die("wrong number of distribution arguments");
+}
+
+/*
+ * sample - Draw a value of at least 1 from distribution d
+ */
+static long sample(const dist_t *d)
+{
+	double v = 1, m;
+
+	switch (d->type)
+	{
+	case DIST_FIXED:
+		v = d->arg[rand64() % d->nargs];
+		break;
+	case DIST_UNIFORM:
+		v = d->arg[0] + floor(rand_unit() * (d->arg[1] - d->arg[0] + 1));
+		break;
+	case DIST_EXP:
+		v = -d->arg[0] * log(rand_unit());
+		break;
+	case DIST_LOGNORMAL:
+		v = d->arg[0] * exp(d->arg[1] * rand_normal());
+		break;
+	case DIST_BIMODAL:
+		m = (rand_unit() < d->arg[2]) ? d->arg[1] : d->arg[0];
+		v = m * exp(BIMODAL_SIGMA * rand_normal());
+		break;
+	}
+	if (v < 1)
+		return 1;
+	return (v > MAXSIZE) ? MAXSIZE : (long)v;
+}
+
+/*
+ * emit - Write one request to the trace; a batch covers group ids
+ */
+static void emit(RequestType type, int id, int size)
+{
+	static const char names[] = {'a', 'f', 'r', 'c', 'm'};
+	traceop_t op;
+
+	if (binary)
+	{
+		op.type = type;
+		op.index = id;
+		op.size = (type == FREE || type == FREE_BATCH) ? 0 : size;
+		if (type == MEMALIGN)
+			op.align = memalign_align;
+		else
+			op.count = (type == ALLOC_BATCH || type == FREE_BATCH) ? group : 0;
+		fwrite(&op, sizeof(op), 1, out);
+	}
+	else if (type == FREE)
+		fprintf(out, "f %d\n", id);
+	else if (type == FREE_BATCH)
+		fprintf(out, "F %d %d\n", id, group);
+	else if (type == ALLOC_BATCH)
+		fprintf(out, "A %d %d %d\n", id, group, size);
+	else if (type == MEMALIGN)
+		fprintf(out, "m %d %d %d\n", id, memalign_align, size);
+	else
+		fprintf(out, "%c %d %d\n", names[type], id, size);
+	ops++;
+}
+
+/*
+ * heap_push, heap_pop - Min-heap of live blocks by time of death
+ */
+static void heap_push(long death, int id)
+{
+	int i = nheap++, parent;
+
+	while (i > 0 && heap[parent = (i - 1) / 2].death > death)
+	{
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i].death = death;
+	heap[i].id = id;
+}
+
+static int heap_pop(void)
+{
+	int id = heap[0].id, i = 0, child;
+	death_t last = heap[--nheap];
+
+	while ((child = 2 * i + 1) < nheap)
+	{
+		if (child + 1 < nheap && heap[child + 1].death < heap[child].death)
+			child++;
+		if (heap[child].death >= last.death)
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return id;
+}
+
+/*
+ * do_alloc - Allocate a group of blocks of the given size that dies
+ *     at death. The group is known by its first id.
+ */
+static void do_alloc(int size, long death)
+{
+	int id = (nfree_ids > 0) ? free_ids[--nfree_ids] : (next_id += group) - group;
+	double u = (calloc_p + memalign_p > 0) ? rand_unit() : 1; /* keeps old seeds' traces */
+	RequestType type = u < calloc_p ? CALLOC : u < calloc_p + memalign_p ? MEMALIGN : ALLOC;
+	int k;
+
+	for (k = 0; k < group; k++)
+		sizes[id + k] = size;
+	live_pos[id] = nheap;
+	live[nheap] = id;
+	heap_push(death, id);
+	live_bytes += (double)size * group;
+	if (live_bytes > peak_bytes)
+		peak_bytes = live_bytes;
+	if (group > 1 && type == ALLOC && !unbatched)
+		emit(ALLOC_BATCH, id, size); /* there are no calloc or memalign batches */
+	else
+		for (k = 0; k < group; k++)
+			emit(type, id + k, size);
+	reqs += group;
+}
+
+/*
+ * do_free - Free the live group that dies soonest
+ */
+static void do_free(void)
+{
+	int id = heap_pop();
+	int last = live[nheap]; /* nheap is now the old count less one */
+	int k;
+
+	live[live_pos[id]] = last;
+	live_pos[last] = live_pos[id];
+	for (k = 0; k < group; k++)
+		live_bytes -= sizes[id + k];
+	free_ids[nfree_ids++] = id;
+	if (group > 1 && !unbatched)
+		emit(FREE_BATCH, id, 0);
+	else
+		for (k = 0; k < group; k++)
+			emit(FREE, id + k, 0);
+	reqs += group;
+}
+
+/*
+ * do_realloc - Grow (or shrink) a random live block
+ */
+static void do_realloc(void)
+{
+	int id = live[rand64() % nheap] + ((group > 1) ? (int)(rand64() % group) : 0);
+	double size = realloc_add ? sizes[id] + realloc_f : sizes[id] * realloc_f;
+
+	size = (size < 1) ? 1 : (size > MAXSIZE) ? MAXSIZE : floor(size);
+	live_bytes += size - sizes[id];
+	if (live_bytes > peak_bytes)
+		peak_bytes = live_bytes;
+	sizes[id] = (int)size;
+	emit(REALLOC, id, sizes[id]);
+	reqs++;
+}
+
+int main(int argc, char **argv)
+{
+	dist_t size_dist, life_dist;
+	const char *outname = NULL;
+	tracehdr_t hdr;
+	char *end;
+	long size;
+	int c;
+
+	parse_dist("lognormal:64,1", &size_dist);
+	parse_dist("exp:1000", &life_dist);
+	while ((c = getopt(argc, argv, "bc:g:Gl:m:n:o:r:s:S:w:h")) != EOF)
+	{
+		switch (c)
+		{
+		case 'b':
+			binary = 1;
+			break;
+		case 'c':
+			if ((calloc_p = strtod(optarg, NULL)) < 0 || calloc_p > 1)
+				die("bad -c");
+			break;
+		case 'g':
+			if ((group = (int)strtol(optarg, NULL, 0)) < 1)
+				die("bad -g");
+			break;
+		case 'G':
+			unbatched = 1;
+			break;
+		case 'l':
+			parse_dist(optarg, &life_dist);
+			break;
+		case 'm':
+			memalign_p = strtod(optarg, &end);
+			if (*end != ',' || memalign_p < 0 || memalign_p > 1)
+				die("-m takes p,align");
+			memalign_align = (int)strtol(end + 1, NULL, 0);
+			if (memalign_align <= 0 || (memalign_align & (memalign_align - 1)) != 0)
+				die("the -m alignment must be a power of two");
+			break;
+		case 'n':
+			if ((num_ops = strtol(optarg, NULL, 0)) < 2 || num_ops > INT32_MAX)
+				die("bad -n");
+			break;
+		case 'o':
+			outname = optarg;
+			break;
+		case 'r':
+			realloc_p = strtod(optarg, &end);
+			if (*end != ',')
+				die("-r takes p,f");
+			realloc_add = (end[1] == '+');
+			realloc_f = strtod(end + 1, NULL);
+			break;
+		case 's':
+			parse_dist(optarg, &size_dist);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0) | 1;
+			break;
+		case 'w':
+			if ((live_target = strtod(optarg, &end)) <= 0)
+				die("bad -w");
+			if (*end == 'k' || *end == 'K')
+				live_target *= 1 << 10;
+			else if (*end == 'm' || *end == 'M')
+				live_target *= 1 << 20;
+			else if (*end == 'g' || *end == 'G')
+				live_target *= 1 << 30;
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			usage();
+			exit(1);
+		}
+	}
+	if (outname == NULL)
+	{
+		usage();
+		exit(1);
+	}
+
+	/* No more than half the requests can be allocations */
+	if (group > num_ops / 2)
+		die("-g is more than half of -n");
+	max_ids = (int)(num_ops / 2 + group);
+	if ((heap = malloc(max_ids * sizeof(death_t))) == NULL ||
+		(live = malloc(max_ids * sizeof(int))) == NULL ||
+		(live_pos = malloc(max_ids * sizeof(int))) == NULL ||
+		(sizes = malloc(max_ids * sizeof(int))) == NULL ||
+		(free_ids = malloc(max_ids * sizeof(int))) == NULL)
+		die("out of memory");
+
+	/*
+	 * The header is rewritten once the counts are known, so the text
+	 * header's numbers are padded to a fixed width
+	 */
+	if ((out = fopen(outname, binary ? "wb" : "w")) == NULL)
+	{
+		perror(outname);
+		exit(1);
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	if (binary)
+		fwrite(&hdr, sizeof(hdr), 1, out);
+	else
+		fprintf(out, "%11d\n%11d\n%11d\n%11d\n", 0, 0, 0, 0);
+
+	/*
+	 * Each allocation commits the trace to a free later, so allocate
+	 * only while there's room for both
+	 */
+	while (reqs + (long)nheap * group < num_ops)
+	{
+		if (nheap > 0 && heap[0].death <= reqs)
+			do_free();
+		else if (nheap > 0 && rand_unit() < realloc_p)
+			do_realloc();
+		else if (reqs + (long)(nheap + 2) * group <= num_ops)
+		{
+			size = sample(&size_dist);
+			if (nheap > 0 && live_bytes + (double)size * group > live_target)
+				do_free();
+			else
+				do_alloc((int)size, reqs + sample(&life_dist));
+		}
+		else if (nheap > 0)
+			do_free();
+		else
+			break; /* too few requests left for another allocation */
+	}
+	while (nheap > 0)
+		do_free();
+
+	/* Now fill in the header */
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = TRACE_VERSION;
+	hdr.sugg_heapsize = (peak_bytes > INT32_MAX) ? INT32_MAX : (int32_t)peak_bytes;
+	hdr.num_ids = next_id;
+	hdr.num_ops = (int32_t)ops;
+	hdr.weight = 1;
+	rewind(out);
+	if (binary)
+		fwrite(&hdr, sizeof(hdr), 1, out);
+	else
+		fprintf(out, "%11d\n%11d\n%11d\n%11d\n",
+				hdr.sugg_heapsize, hdr.num_ids, hdr.num_ops, hdr.weight);
+	if (ferror(out) || fclose(out) != 0)
+	{
+		perror(outname);
+		exit(1);
+	}
+	return 0;
+}